@@ -0,0 +1,101 @@
+#include "T503_client.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+int t503_client_open(struct t503_client *client, const char *socket_path) {
+    struct sockaddr_un addr;
+    struct t503_shm_hello hello;
+    int fds[3] = { -1, -1, -1 };
+    void *map = MAP_FAILED;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) goto error;
+
+    struct iovec iov = { &hello, sizeof(hello) };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { NULL, 0, &iov, 1, control.buf, sizeof(control.buf), 0 };
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(hello)) goto error_protocol;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) goto error_protocol;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    if (hello.version != T503_SHM_VERSION || hello.reader >= T503_SHM_MAX_READERS) goto error_protocol;
+
+    /* Only the daemon writes to the ring, a reader gets nothing else writable than its own flag */
+    map = mmap(NULL, sizeof(struct t503_shm_ring), PROT_READ, MAP_SHARED, fds[0], 0);
+    if (map == MAP_FAILED) goto error;
+    client->ring = (struct t503_shm_ring const *)map;
+    if (client->ring->magic != T503_SHM_MAGIC || client->ring->n_slots != T503_SHM_SLOTS
+        || client->ring->sample_size != sizeof(struct t503_shm_sample)) goto error_protocol;
+
+    void *flag = mmap(NULL, sizeof(struct t503_shm_flag), PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+    if (flag == MAP_FAILED) goto error;
+    close(fds[0]);
+    close(fds[1]);
+
+    client->flag = (struct t503_shm_flag *)flag;
+    client->event_fd = fds[2];
+    client->index = hello.reader;
+    client->socket_fd = fd;
+    t503_shm_reader_init(&client->reader, client->ring);
+    return 0;
+
+error_protocol:
+    errno = EPROTO;
+error:
+    {
+        int error = errno;
+        if (map != MAP_FAILED) munmap(map, sizeof(struct t503_shm_ring));
+        for (size_t i = 0; i < 3; i++) {
+            if (fds[i] != -1) close(fds[i]);
+        }
+        close(fd);
+        errno = error;
+    }
+    return -1;
+}
+
+void t503_client_close(struct t503_client *client) {
+    close(client->socket_fd);
+    close(client->event_fd);
+    munmap((void *)client->ring, sizeof(struct t503_shm_ring));
+    munmap(client->flag, sizeof(struct t503_shm_flag));
+    client->ring = NULL;
+    client->flag = NULL;
+}
+
+int t503_client_wait(struct t503_client *client, int timeout_ms) {
+    uint32_t *waiting = &client->flag->waiting;
+    struct pollfd pfd = { client->event_fd, POLLIN, 0 };
+    uint64_t value;
+
+    if (!t503_shm_empty(&client->reader)) return 1;
+
+    /* Announce the sleep before checking again, the daemon checks the flag after publishing */
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int retn = t503_shm_empty(&client->reader) ? poll(&pfd, 1, timeout_ms) : 1;
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    if (retn == -1) return errno == EINTR ? 0 : -1;
+
+    if (pfd.revents & POLLIN) {
+        if (read(client->event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN) return -1;
+    }
+    return !t503_shm_empty(&client->reader);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "T503_shm.h"
+
+/*
+ * Reader of the samples T503d publishes with --export. Samples are read straight from the shared
+ * mapping, which is read-only, waiting costs a system call only when the ring is empty.
+ */
+struct t503_client {
+    struct t503_shm_ring const *ring;
+    struct t503_shm_flag *flag;
+    struct t503_shm_reader reader;
+    /* Kept open, the daemon drops the eventfd of the reader when it is closed */
+    int socket_fd;
+    int event_fd;
+    uint32_t index;
+};
+
+/* Connects to the export socket, the first sample read is the next one published */
+int t503_client_open(struct t503_client *, const char *socket_path);
+void t503_client_close(struct t503_client *);
+
+/* Copies the next sample, returns 0 when there is none yet */
+static inline int t503_client_read(struct t503_client *client, struct t503_shm_sample *sample) {
+    return t503_shm_read(&client->reader, sample);
+}
+
+/* Samples that were overwritten before they were read */
+static inline uint64_t t503_client_lost(struct t503_client const *client) {
+    return client->reader.lost;
+}
+
+/* Waits at most timeout_ms (-1 for ever) for a sample, returns 1 if there is one, 0 on timeout, -1 on error */
+int t503_client_wait(struct t503_client *, int timeout_ms);
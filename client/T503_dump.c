@@ -0,0 +1,36 @@
+#include "T503_client.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Prints the samples published by T503d --export, one per line */
+int main(int argc, char *argv[]) {
+    struct t503_client client;
+    struct t503_shm_sample sample;
+    uint64_t lost = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SOCKET\n", argv[0]);
+        return -1;
+    }
+    if (t503_client_open(&client, argv[1])) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", argv[1], strerror(errno));
+        return -1;
+    }
+
+    while (t503_client_wait(&client, -1) >= 0) {
+        while (t503_client_read(&client, &sample)) {
+            printf("%" PRIu64 " device %u kind %u pen %x x %u y %u pressure %u buttons %02x/%02x\n",
+                sample.timestamp_ns, sample.device, sample.kind, sample.pen, sample.x, sample.y,
+                sample.pressure, sample.buttons, sample.buttons_valid);
+        }
+        if (t503_client_lost(&client) != lost) {
+            fprintf(stderr, "%" PRIu64 " samples lost\n", t503_client_lost(&client) - lost);
+            lost = t503_client_lost(&client);
+        }
+        fflush(stdout);
+    }
+    t503_client_close(&client);
+    return 0;
+}
@@ -1,574 +1,525 @@
 #include "T503.h"
+#include "T503_alloc_guard.h"
+#include "T503_log.h"
+#include "T503_record.h"
+#include "T503_decode.h"
 #include <stdio.h>
 #include <assert.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
 
 
-static volatile int s_should_exit = 0;
+static int t503_init_signals(struct t503_context *);
+static void t503_exit_signals(struct t503_context *);
 
-static int t503_init_libusb(struct t503_context *);
-static void t503_exit_libusb(struct t503_context *);
-static int t503_init_libevdev(struct t503_context *);
-static void t503_exit_libevdev(struct t503_context *);
+static void signal_cb(void *, uint32_t);
+static void t503_emit_report(struct t503_device *, struct t503_report const *, uint64_t);
+static void t503_debug_report(struct t503_report const *, const uint8_t *, int);
+static void t503_frame_push(struct t503_device *, size_t, uint16_t, uint16_t, int32_t);
+static void t503_frame_flush(struct t503_device *, size_t);
+static void t503_frame_end(struct t503_device *);
+static void t503_print_stats(struct t503_context const *);
 
-static void sigint_handler(int sig); 
-static void transfer_cb(struct libusb_transfer *);
-static void t503_parse_transfer(struct libusb_transfer *);
 
 
-#ifdef NDEBUG
-#define debugf
-#else
-static inline int debugf(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    int retn = vfprintf(stdout, fmt, args);
-    va_end(args);
-    return retn;
-}
-#endif
-
-static inline int errorf(const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
-    int retn = vfprintf(stderr, fmt, args);
-    va_end(args);
-    return retn;
-}
-
-#if defined(_MSC_VER)
-#pragma pack(push, 1)
-#endif
+static const struct t503_source_ops *const s_sources[] = {
+    [T503_TRANSPORT_LIBUSB] = &t503_source_libusb,
+    [T503_TRANSPORT_HIDRAW] = &t503_source_hidraw,
+    [T503_TRANSPORT_MOCK] = &t503_source_mock,
+};
 
+static const struct t503_sink_ops *const s_sinks[] = {
+    [T503_SINK_UINPUT] = &t503_sink_uinput,
+    [T503_SINK_CAPTURE] = &t503_sink_capture,
+};
 
-struct HID_descriptor {
-    uint8_t bLength;
-    uint8_t bDescriptorType;
-    uint16_t bcdHID;
-    uint8_t bCountryCode;
-    uint8_t bNumDescriptors;
-    uint8_t bDescriptorType2;
-    uint16_t wDescriptorLength;
+void t503_exit(struct t503_context *ctx) {
+    t503_exit_export(ctx);
+    if (ctx->record) t503_record_close(ctx->record);
+    ctx->source->exit(ctx);
+    for (size_t i = 0; i < ctx->n_devices; i++) ctx->sink->close(&ctx->devices[i]);
+    ctx->sink->exit(ctx);
+    t503_exit_config(ctx);
+    t503_exit_signals(ctx);
+    t503_reactor_exit(&ctx->reactor);
 }
-#if defined(__GNUC__)
-__attribute__ ((packed))
-#endif
-;
-
-#if defined(_MSC_VER)
-#pragma pack(pop)
-#endif
 
+static void signal_cb(void *user_data, uint32_t events) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    struct signalfd_siginfo info;
 
-
-static void t503_exit_libusb(struct t503_context *ctx) {
-    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
-        assert(ctx->libusb_transfers[i]);
-        libusb_free_transfer(ctx->libusb_transfers[i]);
+    while (read(ctx->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR1) {
+            t503_print_stats(ctx);
+            continue;
+        }
+        debugf("Signal %u received, exiting the loop.\n", info.ssi_signo);
+        ctx->reactor.should_exit = 1;
     }
+}
 
-    assert(ctx->libusb_handle);
-    libusb_release_interface(ctx->libusb_handle, T503_INTERFACE_2);
-    libusb_release_interface(ctx->libusb_handle, T503_INTERFACE_1);
-    libusb_close(ctx->libusb_handle);
+static int t503_init_signals(struct t503_context *ctx) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
 
-    assert(ctx->libusb_config);
-    libusb_free_config_descriptor(ctx->libusb_config);
-    assert(ctx->libusb_ctx);
-    libusb_exit(ctx->libusb_ctx);
-}
+    /* Blocked signals are only delivered through the signalfd */
+    if (sigprocmask(SIG_BLOCK, &mask, NULL)) goto error_sigprocmask;
 
-static void t503_exit_libevdev(struct t503_context *ctx) {
-    assert(ctx->libevdev_uidev);
-    assert(ctx->libevdev_dev);
-    libevdev_uinput_destroy(ctx->libevdev_uidev);
-    libevdev_free(ctx->libevdev_dev);
-}
+    ctx->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ctx->signal_fd == -1) goto error_signalfd;
 
-void t503_exit(struct t503_context *ctx) {
-    t503_exit_libevdev(ctx);
-    t503_exit_libusb(ctx);
+    if (t503_reactor_add(&ctx->reactor, ctx->signal_fd, EPOLLIN, signal_cb, ctx)) {
+        goto error_reactor_add;
+    }
+    return 0;
+
+error_reactor_add:
+    close(ctx->signal_fd);
+    ctx->signal_fd = -1;
+error_signalfd:
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+error_sigprocmask:
+    errorf("Initialize signal handling error!\n");
+    return -1;
 }
 
-static void sigint_handler(int sig) {
-    debugf("SIGINT detected, exiting the loop.\n");
-    s_should_exit = 1;
+static void t503_exit_signals(struct t503_context *ctx) {
+    assert(ctx->signal_fd != -1);
+    t503_reactor_remove(&ctx->reactor, ctx->signal_fd);
+    close(ctx->signal_fd);
+    ctx->signal_fd = -1;
 }
 
 
-static void display_device_descriptor(struct libusb_device_descriptor const *desc) {
-    debugf("Device Descriptor:\n");
+static void t503_frame_flush(struct t503_device *device, size_t node) {
+    struct t503_frame *frame = &device->arena.frame;
+    if (!frame->n_events[node]) return;
 
-    debugf("bLength: %d\n", desc->bLength);
-    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
-    debugf("bcdUSB: %x\n", desc->bcdUSB);
-    debugf("bDeviceClass: %d\n", desc->bDeviceClass);
-    debugf("bDeviceSubClass: %d\n", desc->bDeviceSubClass);
+    device->ctx->sink->write(device, node, frame->events[node], frame->n_events[node]);
+    frame->n_writes++;
+    frame->n_written += frame->n_events[node];
+    frame->n_events[node] = 0;
+}
 
-    debugf("bDeviceProtocol: %d\n", desc->bDeviceProtocol);
-    debugf("bMaxPacketSize0: %d\n", desc->bMaxPacketSize0);
-    debugf("idVendor: %x\n", desc->idVendor);
-    debugf("idProduct: %x\n", desc->idProduct);
-    debugf("bcdDevice: %x\n", desc->bcdDevice);
+static void t503_frame_push(struct t503_device *device, size_t node, uint16_t type, uint16_t code, int32_t value) {
+    struct t503_frame *frame = &device->arena.frame;
+    /* Should not happen with sane key mappings, but never drop events */
+    if (frame->n_events[node] == T503_FRAME_MAX_EVENTS) t503_frame_flush(device, node);
 
-    debugf("iManufacturer: %x\n", desc->iManufacturer);
-    debugf("iProduct: %x\n", desc->iProduct);
-    debugf("iSerialNumber: %x\n", desc->iSerialNumber);
-    debugf("bNumConfigurations: %x\n\n", desc->bNumConfigurations);
+    struct input_event *ev = &frame->events[node][frame->n_events[node]++];
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
 }
 
-static void display_config_descriptor(struct libusb_config_descriptor const *desc) {
-    debugf("Configuration Descriptor:\n");
-
-    debugf("bLength: %d\n", desc->bLength);
-    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
-    debugf("wTotalLength: %d\n", desc->wTotalLength);
-    debugf("bNumInterfaces: %d\n", desc->bNumInterfaces);
-    debugf("bConfigurationValue: %d\n", desc->bConfigurationValue);
+/* Also dumped on SIGUSR1 while running */
+static void t503_print_stats(struct t503_context const *ctx) {
+    int armed = t503_alloc_guard_disarm();
+    t503_log_flush();
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        struct t503_device const *device = &ctx->devices[i];
+        if (ctx->n_devices > 1) fprintf(stdout, "device %zu:\n", i);
+        t503_stats_print(&device->stats, stdout);
+        fprintf(stdout, "%s: %llu events in %llu writes\n", ctx->sink->name,
+            (unsigned long long)device->arena.frame.n_written,
+            (unsigned long long)device->arena.frame.n_writes);
+    }
+    if (t503_load(&ctx->wakeup.count)) t503_histogram_print(&ctx->wakeup, "wakeup latency", stdout);
+    fflush(stdout);
+    if (armed) t503_alloc_guard_arm();
+}
 
-    debugf("iConfiguration: %d\n", desc->iConfiguration);
-    debugf("bmAttributes: %d\n", desc->bmAttributes);
-    debugf("MaxPower: %d\n", desc->MaxPower);
+void t503_handle_report(struct t503_device *device, size_t endpoint, const uint8_t *data, int length, uint64_t received_ns) {
+    if (device->ctx->record) t503_record_write(device->ctx->record, device->index, endpoint, data, length, received_ns);
 
-    debugf("extra_length: %d\n\n", desc->extra_length);
-}
+    t503_stats_report(&device->stats, endpoint, received_ns);
 
-static void display_interface_descriptor(struct libusb_interface_descriptor const *conf) {
-    debugf("Interface Descriptor:\n");
+    struct t503_report report;
+    device->decode(data, length, &report);
+    if (report.unknown) t503_counter_inc(&device->stats.unknown);
+    uint64_t decoded_ns = t503_now_ns();
+    t503_histogram_add(&device->stats.decode, decoded_ns - received_ns);
+    if (t503_log_enabled(T503_LOG_DEBUG)) t503_debug_report(&report, data, length);
+    if (device->ctx->export.ring && report.kind != T503_REPORT_UNKNOWN) {
+        t503_export_report(&device->ctx->export, device->index, &report, received_ns);
+    }
 
-    debugf("bLength: %d\n", conf->bLength);
-    debugf("bDescriptorType: %d\n", conf->bDescriptorType);
-    debugf("bInterfaceNumber: %d\n", conf->bInterfaceNumber);
-    debugf("bAlternateSetting: %d\n", conf->bAlternateSetting);
-    debugf("bNumEndpoints: %d\n", conf->bNumEndpoints);
+    /* Reports that change nothing are not written and have no emit latency */
+    uint64_t n_writes = device->arena.frame.n_writes;
+    int was_open = device->pen.open;
+    device->frame_time_ns = t503_timebase_update(&device->timebase[endpoint], received_ns);
+    t503_emit_report(device, &report, received_ns);
+    if (device->pen.open && !was_open) {
+        device->pen.open_received_ns = received_ns;
+        device->pen.open_decoded_ns = decoded_ns;
+    }
+    if (device->arena.frame.n_writes == n_writes) return;
 
-    debugf("bInterfaceClass: %d\n", conf->bInterfaceClass);
-    debugf("bInterfaceSubClass: %d\n", conf->bInterfaceSubClass);
-    debugf("bInterfaceProtocol: %d\n", conf->bInterfaceProtocol);
-    debugf("iInterface: %d\n", conf->iInterface);
+    uint64_t written_ns = t503_now_ns();
+    t503_histogram_add(&device->stats.emit, written_ns - decoded_ns);
+    t503_histogram_add(&device->stats.total, written_ns - received_ns);
+}
 
-    debugf("extra_length: %d\n\n", conf->extra_length);
+void t503_startup_step(struct t503_context *ctx, const char *name) {
+    struct t503_startup *startup = &ctx->startup;
+    uint64_t now = t503_now_ns();
+    if (startup->n_steps < T503_MAX_STARTUP_STEPS) {
+        startup->names[startup->n_steps] = name;
+        startup->durations_ns[startup->n_steps++] = now - startup->last_ns;
+    }
+    startup->last_ns = now;
 }
 
-static void display_endpoint_descriptor(struct libusb_endpoint_descriptor const *desc) {
-    debugf("Endpoint Descriptor:\n");
-
-    debugf("bLength: %d\n", desc->bLength);
-    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
-    debugf("bEndpointAddress: %d\n", desc->bEndpointAddress);
-    debugf("bEndpointAddress: endpoint number %d\n",
-        desc->bEndpointAddress & LIBUSB_ENDPOINT_ADDRESS_MASK);
-    debugf("bEndpointAddress: Is direction IN? %d\n",
-        (desc->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN);
-    debugf("bmAttributes: %d\n", desc->bmAttributes);
-    debugf("bmAttributes: endpoint transfer type %d\n",
-        desc->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK);
-    debugf("bmAttributes: synchronization type %d\n",
-        (desc->bmAttributes & LIBUSB_ISO_SYNC_TYPE_MASK) >> 2);
-    debugf("bmAttributes: usage type %d\n",
-        (desc->bmAttributes & LIBUSB_ISO_USAGE_TYPE_MASK) >> 4);
-    debugf("wMaxPacketSize: %d\n", desc->wMaxPacketSize);
-
-    debugf("bInterval: %d\n", desc->bInterval);
-    debugf("bRefresh: %d\n", desc->bRefresh);
-    debugf("bSynchAddress: %d\n", desc->bSynchAddress);
-
-    debugf("extra_length: %d\n\n", desc->extra_length);
+static void t503_print_startup(struct t503_context const *ctx) {
+    struct t503_startup const *startup = &ctx->startup;
+    t503_log_flush();
+    for (size_t i = 0; i < startup->n_steps; i++) {
+        fprintf(stdout, "startup: %s %.2f ms\n", startup->names[i], startup->durations_ns[i] / 1e6);
+    }
+    fprintf(stdout, "startup: %.2f ms in total\n", (startup->last_ns - startup->start_ns) / 1e6);
+    fflush(stdout);
 }
 
-static void display_HID_descriptor(struct HID_descriptor const *desc) {
-    debugf("HID Descriptor:\n");
+int t503_init(struct t503_context *ctx, struct t503_options const *opts) {
+    ctx->startup.start_ns = t503_now_ns();
+    ctx->startup.last_ns = ctx->startup.start_ns;
+    ctx->startup.n_steps = 0;
+    ctx->signal_fd = -1;
+    ctx->source = s_sources[opts->transport];
+    ctx->sink = s_sinks[opts->sink];
+    ctx->mock = opts->mock;
+    ctx->capture = opts->capture;
+    ctx->record = NULL;
+    ctx->n_devices = 0;
+    memset(&ctx->wakeup, 0, sizeof(ctx->wakeup));
+
+    int retn = t503_reactor_init(&ctx->reactor);
+    if (retn) goto error_t503_reactor_init;
+
+    retn = t503_init_signals(ctx);
+    if (retn) goto error_t503_init_signals;
+    t503_startup_step(ctx, "reactor");
+
+    /* Before the devices, whose sinks enable the keys of the configuration */
+    retn = t503_init_config(ctx, opts);
+    if (retn) goto error_t503_init_config;
+    t503_startup_step(ctx, "config");
+
+    retn = ctx->sink->init(ctx, opts);
+    if (retn) goto error_sink_init;
+    t503_startup_step(ctx, "sink");
+
+    retn = ctx->source->init(ctx, opts);
+    if (retn) goto error_source_init;
+    t503_startup_step(ctx, ctx->source->name);
+
+    if (opts->record_path) {
+        ctx->record = t503_record_open(opts->record_path, ctx->record_buffer, sizeof(ctx->record_buffer));
+        if (!ctx->record) goto error_record_open;
+        t503_startup_step(ctx, "record");
+    }
 
-    debugf("bLength: %d\n", desc->bLength);
-    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
-    debugf("bcdHID: %d\n", desc->bcdHID);
-    debugf("bCountryCode: %d\n", desc->bCountryCode);
-    debugf("bNumDescriptors: %d\n", desc->bNumDescriptors);
+    retn = t503_init_export(ctx, opts);
+    if (retn) goto error_t503_init_export;
+    if (opts->export_path) t503_startup_step(ctx, "export");
 
-    debugf("bDescriptorType2: %d\n", desc->bDescriptorType2);
-    debugf("wDescriptorLength: %d\n\n", desc->wDescriptorLength);
+    if (opts->startup_timing) t503_print_startup(ctx);
+    return 0;
 
+error_t503_init_export:
+    if (ctx->record) t503_record_close(ctx->record);
+    ctx->record = NULL;
+error_record_open:
+    ctx->source->exit(ctx);
+error_source_init:
+    for (size_t i = 0; i < ctx->n_devices; i++) ctx->sink->close(&ctx->devices[i]);
+    ctx->n_devices = 0;
+    ctx->sink->exit(ctx);
+error_sink_init:
+    t503_exit_config(ctx);
+error_t503_init_config:
+    t503_exit_signals(ctx);
+error_t503_init_signals:
+    t503_reactor_exit(&ctx->reactor);
+error_t503_reactor_init:
+    errorf("T503 Initialization failed!\n");
+    return -1;
 }
 
-static void display_transfer(struct libusb_transfer *transfer) {
-    if (transfer == NULL) {
-        debugf("No transfer... Why?\n");
-    } else {
-        debugf("struct libusb_transfer:\n");
-        debugf("flags: %x \n", transfer->flags);
-        debugf("endpoint: %x \n", transfer->endpoint);
-        debugf("type: %x \n", transfer->type);
-        debugf("timeout: %d \n", transfer->timeout);
-        debugf("status: %d \n", transfer->status);
-
-        debugf("length: %d \n", transfer->length);
-        debugf("actual_length: %d \n", transfer->actual_length);
-        debugf("buffer: %p \n", transfer->buffer);
-
-        for (size_t i = 0; i < transfer->actual_length; i++){
-            debugf("%02x", transfer->buffer[i]);
+static void t503_debug_report(struct t503_report const *report, const uint8_t *data, int length) {
+    if (report->unknown) {
+        debugf("Unknown data sequence: ");
+        for (int i = 0; i < length; i++) {
+            debugf("%02x", data[i]);
         }
         debugf("\n");
     }
-    return;
-}
 
-static void transfer_cb(struct libusb_transfer *transfer) {
-    display_transfer(transfer);
-
-    switch (transfer->status) {
-    case LIBUSB_TRANSFER_CANCELLED:
-        break;
-    case LIBUSB_TRANSFER_COMPLETED:
-        t503_parse_transfer(transfer);
-        libusb_submit_transfer(transfer);
-        break;
-    default:
-        debugf("Unhandled status: %d\n", transfer->status);
-    }
+    if (report->buttons & T503_BUTTON_BIT_1) debugf("btn1 ");
+    if (report->buttons & T503_BUTTON_BIT_2) debugf("btn2 ");
+    if (report->buttons & T503_BUTTON_BIT_3) debugf("btn3 ");
+    if (report->buttons & T503_BUTTON_BIT_4) debugf("btn4 ");
+    if (report->buttons & T503_BUTTON_BIT_PLUS) debugf("btn+ ");
+    if (report->buttons & T503_BUTTON_BIT_MINUS) debugf("btn- ");
+    if (report->pen & T503_PEN_MOVE) debugf("penmov ");
+    if (report->pen & T503_PEN_DOWN) debugf("pendown ");
+    if (report->pressure) debugf("pressure=%u ", report->pressure);
+    if (report->pen & T503_PEN_MOVE) debugf("posxy=%u,%u ", report->x, report->y);
+    debugf("\n");
 }
 
-static int t503_init_libusb(struct t503_context *ctx) {
-    int retn = libusb_init(&ctx->libusb_ctx);
-    if (retn) goto error_libusb_init;
-
-    libusb_device **devices;
-    libusb_device *device = NULL;
-    retn = libusb_get_device_list(ctx->libusb_ctx, &devices);
-    if (retn < 0) goto error_libusb_get_device_list;
-    size_t ndevices = retn;
-
-    for (size_t i = 0; i < ndevices; i++) {
-        libusb_device *curr_device = devices[i];
-        struct libusb_device_descriptor desc;
-        libusb_get_device_descriptor(curr_device, &desc);
-        if (desc.idVendor == T503_ID_VENDOR
-            && desc.idProduct == T503_ID_PRODUCT) {
-                device = curr_device;
-                display_device_descriptor(&desc);
-                break;
+static void t503_press_button(struct t503_device *device, struct t503_keymap const *keymap, size_t button) {
+    const uint16_t *keys = keymap->keys[button];
+    for (size_t i = 0; i < keymap->n_keys[button]; i++) {
+        if (device->key_refs[keys[i]]++ == 0) {
+            t503_frame_push(device, t503_key_node(keys[i]), EV_KEY, keys[i], 1);
         }
     }
-    if (!device) {
-        retn = 1;
-        goto error_device_not_found;
-    }
+}
 
-    retn = libusb_get_config_descriptor(device, 0, &ctx->libusb_config);
-    if (retn < 0) goto error_libusb_get_config_descriptor;
-    display_config_descriptor(ctx->libusb_config);
-
-    display_interface_descriptor(ctx->libusb_config->interface[0].altsetting);
-    display_interface_descriptor(ctx->libusb_config->interface[1].altsetting);
-    display_interface_descriptor(ctx->libusb_config->interface[2].altsetting);
-    
-    display_endpoint_descriptor(&ctx->libusb_config->interface[0].altsetting->endpoint[0]);
-    display_endpoint_descriptor(&ctx->libusb_config->interface[0].altsetting->endpoint[1]);
-    display_endpoint_descriptor(&ctx->libusb_config->interface[1].altsetting->endpoint[0]);
-    display_endpoint_descriptor(&ctx->libusb_config->interface[2].altsetting->endpoint[0]);
-
-    display_HID_descriptor((const struct HID_descriptor *)
-        ctx->libusb_config->interface[1].altsetting->extra);
-    display_HID_descriptor((const struct HID_descriptor *)
-        ctx->libusb_config->interface[2].altsetting->extra);
-
-    libusb_device_handle *handle;
-    retn = libusb_open(device, &handle);
-    if (retn) goto error_libusb_open;
-    ctx->libusb_handle = handle;
-
-    unsigned char buf[1024] = {};
-    libusb_get_string_descriptor_ascii(ctx->libusb_handle, 0, buf, sizeof(buf));
-    debugf("string 0: %s\n", buf);
-    libusb_get_string_descriptor_ascii(ctx->libusb_handle, 1, buf, sizeof(buf));
-    debugf("string 1: %s\n", buf);
-    libusb_get_string_descriptor_ascii(ctx->libusb_handle, 2, buf, sizeof(buf));
-    debugf("string 2: %s\n", buf);
-    libusb_get_string_descriptor_ascii(ctx->libusb_handle, 3, buf, sizeof(buf));
-    debugf("string 3: %s\n", buf);
-
-    retn = libusb_set_auto_detach_kernel_driver(handle, 1);
-    if (retn) goto error_libusb_set_auto_detach_kernel_driver;
-
-    retn = libusb_claim_interface(handle, T503_INTERFACE_1);
-    if (retn) goto error_libusb_claim_interface_1;
-    retn = libusb_claim_interface(handle, T503_INTERFACE_2);
-    if (retn) goto error_libusb_claim_interface_2;
-
-
-    ctx->libusb_endpoint_addresses[0] = ctx->libusb_config->interface[T503_INTERFACE_1].altsetting
-                                         ->endpoint[0].bEndpointAddress;
-    ctx->libusb_endpoint_addresses[1] = ctx->libusb_config->interface[T503_INTERFACE_2].altsetting
-                                         ->endpoint[0].bEndpointAddress;
-
-
-    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
-        ctx->libusb_transfers[i] = libusb_alloc_transfer(0);
-        if (!ctx->libusb_transfers[i]) {
-            for (size_t j = 0; j < i; j++) {
-                libusb_free_transfer(ctx->libusb_transfers[j]);
-            }
-            retn = 3;
-            goto error_libusb_alloc_transfer;
+/* Keys go up in reverse order so that modifiers are released last */
+static void t503_release_button(struct t503_device *device, struct t503_keymap const *keymap, size_t button) {
+    const uint16_t *keys = keymap->keys[button];
+    for (size_t i = keymap->n_keys[button]; i-- > 0;) {
+        if (--device->key_refs[keys[i]] == 0) {
+            t503_frame_push(device, t503_key_node(keys[i]), EV_KEY, keys[i], 0);
         }
-        libusb_fill_interrupt_transfer(
-            ctx->libusb_transfers[i], handle, ctx->libusb_endpoint_addresses[i],
-            ctx->buffer[i], T503_IO_BUFFER_SIZE,
-            transfer_cb, (void *)ctx, 0
-        );
     }
+}
 
+/* Runs between two reports on the event loop, so no report sees a half-applied configuration */
+void t503_apply_config(struct t503_context *ctx, struct t503_config *config) {
+    for (size_t d = 0; d < ctx->n_devices; d++) {
+        struct t503_device *device = &ctx->devices[d];
 
-    libusb_free_device_list(devices, 1);
-    return 0;
+        /* Press under the new bindings first, keys bound in both stay down */
+        for (size_t i = 0; i < T503_N_BUTTONS; i++) {
+            if (device->buttons & (1u << i)) t503_press_button(device, &config->keymap, i);
+        }
+        for (size_t i = 0; i < T503_N_BUTTONS; i++) {
+            if (device->buttons & (1u << i)) t503_release_button(device, &ctx->config->keymap, i);
+        }
+        /* The reload was refused unless the ranges stay the same */
+        t503_config_build_transform(config, device->profile, &device->transform);
 
-/* Warning: the label below should be in reversed order compared to the corresponding above */
-
-error_libusb_alloc_transfer:
-    libusb_release_interface(handle, T503_INTERFACE_2);
-error_libusb_claim_interface_2:
-    libusb_release_interface(handle, T503_INTERFACE_1);
-error_libusb_claim_interface_1:
-error_libusb_set_auto_detach_kernel_driver:
-    libusb_close(handle);
-error_libusb_open:
-    libusb_free_config_descriptor(ctx->libusb_config);
-error_libusb_get_config_descriptor:
-error_device_not_found:
-    libusb_free_device_list(devices, 1);
-error_libusb_get_device_list:
-    libusb_exit(ctx->libusb_ctx);
-error_libusb_init:
-    if (retn < 0) {
-        errorf("T503 Error: %s\n", libusb_strerror(retn));
-    } else {
-        errorf("Some error happens, position = %d\n", retn);
+        device->frame_time_ns = t503_now_ns();
+        t503_frame_end(device);
     }
-
-    assert(ctx->libusb_handle == NULL);
-    return -1;
+    ctx->config = config;
 }
 
-static int t503_init_libevdev(struct t503_context *ctx) {
-    struct libevdev *dev = libevdev_new();
-    if (!dev) goto error_libevdev_new;
-
-    int retn;
-
-    libevdev_set_name(dev, "test device");
-
-    retn = libevdev_enable_event_type(dev, EV_ABS);
-    if (retn == -1) goto error_libevdev_enable_events;
-    struct input_absinfo absinfo_x = {
-        0, 0, T503_MAX_X, 0, 0, T503_RESOLUTION_X
-    };
-    struct input_absinfo absinfo_y = {
-        0, 0, T503_MAX_Y, 0, 0, T503_RESOLUTION_Y
-    };
-    struct input_absinfo absinfo_p = {
-        0, 0, T503_MAX_PRESSURE, 0, 0, 0
-    };
-    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_X, &absinfo_x);
-    if (retn == -1) goto error_libevdev_enable_events;
-    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &absinfo_y);
-    if (retn == -1) goto error_libevdev_enable_events;
-    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_PRESSURE, &absinfo_p);
-    if (retn == -1) goto error_libevdev_enable_events;
-
-    retn = libevdev_enable_event_type(dev, EV_KEY);
-    if (retn == -1) goto error_libevdev_enable_events;
-    /* BTN_STYLUS means this device is a pen */
-    libevdev_enable_event_code(dev, EV_KEY, BTN_STYLUS, NULL);
-    if (retn == -1) goto error_libevdev_enable_events;
-#define T503_GEN_ENABLE_EVENT_CODE(key) \
-    for (size_t i = 0; i < T503_COUNT_OF(g_mapping_ ## key); i++) { \
-        retn = libevdev_enable_event_code(dev, EV_KEY, g_mapping_ ## key[i], NULL); \
-        if (retn == -1) goto error_libevdev_enable_events; \
+static const uint16_t s_pen_types[T503_PEN_N_AXES] = {
+    [T503_PEN_X] = EV_ABS,
+    [T503_PEN_Y] = EV_ABS,
+    [T503_PEN_PRESSURE] = EV_ABS,
+    [T503_PEN_TOOL] = EV_KEY,
+    [T503_PEN_TOUCH] = EV_KEY,
+};
+
+static const uint16_t s_pen_codes[T503_PEN_N_AXES] = {
+    [T503_PEN_X] = ABS_X,
+    [T503_PEN_Y] = ABS_Y,
+    [T503_PEN_PRESSURE] = ABS_PRESSURE,
+    [T503_PEN_TOOL] = BTN_TOOL_PEN,
+    [T503_PEN_TOUCH] = BTN_TOUCH,
+};
+
+/* Pen values whose change is written right away like a key, so that a tap or a hover never cancels out */
+#define T503_PEN_STATE_MASK ((1u << T503_PEN_TOOL) | (1u << T503_PEN_TOUCH))
+
+/*
+ * Keeps a new pen value for the next frame unless the sink already has it, or one within the deadband.
+ * Touching and lifting the pen always get through the deadband.
+ */
+static void t503_pen_update(struct t503_device *device, size_t axis, int32_t value, uint32_t deadband) {
+    struct t503_pen_state *pen = &device->pen;
+    uint8_t bit = 1u << axis;
+    int32_t written = pen->written[axis];
+    uint32_t distance = value > written ? (uint32_t)(value - written) : (uint32_t)(written - value);
+
+    /* A pending value that is not written either way was merged away */
+    if (pen->pending_mask & bit) t503_counter_inc(&device->stats.events_saved);
+    if ((pen->written_valid & bit) && distance <= deadband
+        && (axis != T503_PEN_PRESSURE || !value == !written)) {
+        pen->pending_mask &= ~bit;
+        t503_counter_inc(&device->stats.events_saved);
+        return;
     }
-    T503_GEN_ENABLE_EVENT_CODE(1);
-    T503_GEN_ENABLE_EVENT_CODE(2);
-    T503_GEN_ENABLE_EVENT_CODE(3);
-    T503_GEN_ENABLE_EVENT_CODE(4);
-    T503_GEN_ENABLE_EVENT_CODE(plus);
-    T503_GEN_ENABLE_EVENT_CODE(minus);
-#undef T503_GEN_ENABLE_EVENT_CODE
-
-
-    struct libevdev_uinput *uidev;
-
-    retn = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
-    if (retn) goto error_libevdev_uinput_create_from_device;
-
-    ctx->libevdev_dev = dev;
-    ctx->libevdev_uidev = uidev;
-    return 0;
-
-error_libevdev_uinput_create_from_device:
-error_libevdev_enable_events:
-    libevdev_free(dev);
-error_libevdev_new:
-    errorf("Initialize evdev error!\n");
-    return -1;
+    pen->pending[axis] = value;
+    pen->pending_mask |= bit;
 }
 
-int t503_init(struct t503_context *ctx) {
-    ctx->libusb_ctx = NULL;
-    ctx->libusb_handle = NULL;
-    ctx->libusb_config = NULL;
-    ctx->libusb_endpoint_addresses[0] = 0;
-    ctx->libusb_endpoint_addresses[1] = 0;
-    ctx->libusb_transfers[0] = NULL;
-    ctx->libusb_transfers[1] = NULL;
-    ctx->libevdev_dev = NULL;
-    ctx->libevdev_uidev = NULL;
-    ctx->prev_mapping = NULL;
-    ctx->prev_mapping_len = 0;
-
-    int retn = t503_init_libusb(ctx);
-    if (retn) goto error_t503_init_libusb;
-
-    retn = t503_init_libevdev(ctx);
-    if (retn) goto error_t503_init_libevdev;
-
+static void t503_pen_push(struct t503_device *device) {
+    struct t503_pen_state *pen = &device->pen;
+    for (size_t axis = 0; axis < T503_PEN_N_AXES; axis++) {
+        if (!(pen->pending_mask & (1u << axis))) continue;
+        t503_frame_push(device, T503_NODE_PEN, s_pen_types[axis], s_pen_codes[axis], pen->pending[axis]);
+        pen->written[axis] = pen->pending[axis];
+    }
+    pen->written_valid |= pen->pending_mask;
+    pen->pending_mask = 0;
+}
 
-    if (signal(SIGINT, sigint_handler) == SIG_ERR) {
-        retn = 5;
-        goto error_signal;
-    } 
+static int t503_frame_empty(struct t503_device const *device) {
+    for (size_t node = 0; node < T503_N_NODES; node++) {
+        if (device->arena.frame.n_events[node]) return 0;
+    }
+    return 1;
+}
 
-    return 0;
+/* Writes the frame of a device with the pending pen values, a frame left empty saved its write */
+static void t503_frame_end(struct t503_device *device) {
+    struct t503_pen_state *pen = &device->pen;
+
+    t503_pen_push(device);
+    if (!t503_frame_empty(device)) {
+        for (size_t node = 0; node < T503_N_NODES; node++) {
+            if (!device->arena.frame.n_events[node]) continue;
+            /* Microseconds that wrap around, like the timestamps of HID devices */
+            t503_frame_push(device, node, EV_MSC, MSC_TIMESTAMP, (int32_t)(uint32_t)(device->frame_time_ns / 1000));
+            t503_frame_push(device, node, EV_SYN, SYN_REPORT, 0);
+            t503_frame_flush(device, node);
+        }
+    } else if (pen->open) {
+        t503_counter_inc(&device->stats.events_saved);
+        t503_counter_inc(&device->stats.writes_saved);
+    }
+    pen->open = 0;
+}
 
-error_signal:
-    t503_exit_libevdev(ctx);
-error_t503_init_libevdev:
-    t503_exit_libusb(ctx);
-error_t503_init_libusb:
-    errorf("T503 Initialization failed!\n");
-    return -1;
+/* Writes the frames coalesced during the event loop pass, each at the latency of its first report */
+static void t503_end_open_frames(struct t503_context *ctx) {
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        struct t503_device *device = &ctx->devices[i];
+        if (!device->pen.open) continue;
+
+        uint64_t n_writes = device->arena.frame.n_writes;
+        t503_frame_end(device);
+        if (device->arena.frame.n_writes == n_writes) continue;
+        uint64_t written_ns = t503_now_ns();
+        t503_histogram_add(&device->stats.emit, written_ns - device->pen.open_decoded_ns);
+        t503_histogram_add(&device->stats.total, written_ns - device->pen.open_received_ns);
+    }
 }
 
-static void t503_parse_transfer(struct libusb_transfer *transfer) {
-    uint8_t *data = transfer->buffer;
-    struct t503_context *ctx = (struct t503_context *)transfer->user_data;
-    uint8_t button_minus = 0, button_plus = 0;
-    uint8_t button_1 = 0, button_2 = 0, button_3 = 0, button_4 = 0;
-    uint8_t pen_move = 0, pen_down = 0;
-    uint16_t pos_x, pos_y, pressure = 0;
-
-    switch (data[0]) {
-    case 0x02:
-        if (data[1] & 0x01) button_minus = 1;
-        if (data[1] & 0x02) button_1 = 1;
-        if (data[1] & 0x04) button_2 = 1;
-        if (data[1] & ~0x07) debugf("Unknown data sequence 0x02[%02x]\n", data[1]);
-        switch (data[3]) {
-        case 0x00:
-            break;
-        case 0x2c:
-            button_3 = 1;
-            break;
-        case 0x2b:
-            button_4 = 1;
-            break;
-        case 0x1d:
-            if (button_minus) break;
-        default:
-            debugf("Unknown data sequence 0x02????[%02x]\n", data[3]);
-        }
-        break;
-    case 0x03:
-        switch (data[1]) {
-        case 0x00:
-            break;
-        case 0x02:
-            button_plus = 1;
-            break;
-        default:
-            debugf("Unknown data sequence 0x03[%02x]\n", data[1]);
-        }
-        break;
-    case 0x05:
-        if (data[1] & 0x01) pen_down = 1;
-        if (data[1] & 0xc0) pen_move = 1;
-        if (data[1] & ~0xc1) debugf("Unknown data sequence: 0x05[%02x]\n", data[1]);
-
-        pos_x = T503_MAX_X - *(uint16_t *)&data[4];
-        pos_y = *(uint16_t *)&data[2];
-        pressure = *(uint16_t *)&data[6];
-        break;
-    default:
-        debugf("Unknown data sequence: 0x[%02x]\nFull data sequence: ", data[0]);
-        for (size_t i = 0; i < transfer->actual_length; i++) {
-            debugf("%02x", data[i]);
+static void t503_emit_report(struct t503_device *device, struct t503_report const *report, uint64_t received_ns) {
+    struct t503_config const *config = device->ctx->config;
+    struct t503_keymap const *keymap = &config->keymap;
+
+    if (report->pen & T503_PEN_MOVE) {
+        uint16_t raw[2] = { report->x, report->y };
+        int32_t position[2];
+        if (t503_prediction_enabled(&config->prediction)) {
+            uint16_t const max[2] = { device->profile->max_x, device->profile->max_y };
+            t503_predict(&device->predictor, &config->prediction, received_ns, report->x, report->y, max, raw);
         }
-        debugf("\n");
+        t503_transform_apply(&device->transform, raw[0], raw[1], position);
+        uint16_t level = (uint16_t)(((uint64_t)report->pressure * device->pressure_scale) >> T503_PRESSURE_SCALE_SHIFT);
+        t503_pen_update(device, T503_PEN_X, position[0], config->filter.position_deadband);
+        t503_pen_update(device, T503_PEN_Y, position[1], config->filter.position_deadband);
+        t503_pen_update(device, T503_PEN_PRESSURE, t503_config_pressure(config, level),
+                        config->filter.pressure_deadband);
+        t503_pen_update(device, T503_PEN_TOOL, 1, 0);
+        t503_pen_update(device, T503_PEN_TOUCH, !!(report->pen & T503_PEN_DOWN), 0);
+    } else if (report->kind == T503_REPORT_PEN) {
+        /* The pen left, its next position starts a new stroke */
+        t503_pen_update(device, T503_PEN_PRESSURE, 0, 0);
+        t503_pen_update(device, T503_PEN_TOUCH, 0, 0);
+        t503_pen_update(device, T503_PEN_TOOL, 0, 0);
+        t503_predictor_reset(&device->predictor);
     }
 
-    if (button_1) debugf("btn1 ");
-    if (button_2) debugf("btn2 ");
-    if (button_3) debugf("btn3 ");
-    if (button_4) debugf("btn4 ");
-    if (button_plus) debugf("btn+ ");
-    if (button_minus) debugf("btn- ");
-    if (pen_move) debugf("penmov ");
-    if (pen_down) debugf("pendown ");
-    if (pressure) debugf("pressure=%u ", pressure);
-    if (pen_move) debugf("posxy=%u,%u ", pos_x, pos_y);
-    debugf("\n");
+    /* A report only carries the state of some buttons, the others keep theirs */
+    uint8_t buttons = (device->buttons & ~report->buttons_valid) | (report->buttons & report->buttons_valid);
+    uint8_t released = device->buttons & ~buttons;
+    uint8_t pressed = buttons & ~device->buttons;
+    device->buttons = buttons;
 
-    if (pen_move) {
-        libevdev_uinput_write_event(ctx->libevdev_uidev,
-            EV_ABS, ABS_X, pos_x);
-        libevdev_uinput_write_event(ctx->libevdev_uidev,
-            EV_ABS, ABS_Y, pos_y);
-        libevdev_uinput_write_event(ctx->libevdev_uidev,
-            EV_ABS, ABS_PRESSURE, pressure);
+    for (size_t i = 0; released; i++, released >>= 1) {
+        if (released & 1) t503_release_button(device, keymap, i);
     }
-
-#define T503_GEN_UINPUT_WRITE_EVENT(key) \
-    else if (button_ ## key) { \
-        for (size_t i = 0; i < T503_COUNT_OF(g_mapping_ ## key); i++) { \
-            libevdev_uinput_write_event(ctx->libevdev_uidev, \
-                EV_KEY, g_mapping_ ## key[i], 1); \
-        } \
-        ctx->prev_mapping = g_mapping_ ## key; \
-        ctx->prev_mapping_len = T503_COUNT_OF(g_mapping_ ## key); \
+    for (size_t i = 0; pressed; i++, pressed >>= 1) {
+        if (pressed & 1) t503_press_button(device, keymap, i);
     }
-    T503_GEN_UINPUT_WRITE_EVENT(1)
-    T503_GEN_UINPUT_WRITE_EVENT(2)
-    T503_GEN_UINPUT_WRITE_EVENT(3)
-    T503_GEN_UINPUT_WRITE_EVENT(4)
-    T503_GEN_UINPUT_WRITE_EVENT(plus)
-    T503_GEN_UINPUT_WRITE_EVENT(minus)
-#undef T503_GEN_UINPUT_WRITE_EVENT
-    else {
-        for (size_t i = 0; i < ctx->prev_mapping_len; i++) {
-            libevdev_uinput_write_event(ctx->libevdev_uidev,
-                EV_KEY, ctx->prev_mapping[i], 0);
+
+    if (t503_frame_empty(device)) {
+        /* Nothing changed, e.g. a repeated pad report while a button is held */
+        if (report->kind != T503_REPORT_PEN) return;
+        /* The pen report is merged into the open frame, or the sink already has all of it */
+        if (device->pen.open || !device->pen.pending_mask) {
+            t503_counter_inc(&device->stats.events_saved);
+            t503_counter_inc(&device->stats.writes_saved);
+        }
+        if (!device->pen.open && !device->pen.pending_mask) return;
+        uint8_t pending = device->pen.pending_mask;
+        if (config->filter.coalesce && pending && !(pending & T503_PEN_STATE_MASK)) {
+            device->pen.open = 1;
+            return;
         }
     }
+    /* Keys, touch and proximity are written right away, so that a quick press and release never merge */
+    t503_frame_end(device);
+}
 
-    libevdev_uinput_write_event(ctx->libevdev_uidev,
-        EV_SYN, SYN_REPORT, 0);
+void t503_release_all(struct t503_device *device) {
+    struct t503_report report;
+    memset(&report, 0, sizeof(report));
+    report.buttons_valid = device->profile->buttons;
+
+    t503_pen_update(device, T503_PEN_PRESSURE, 0, 0);
+    t503_pen_update(device, T503_PEN_TOUCH, 0, 0);
+    t503_pen_update(device, T503_PEN_TOOL, 0, 0);
+    device->frame_time_ns = t503_now_ns();
+    t503_emit_report(device, &report, 0);
+    t503_frame_end(device);
+    t503_predictor_reset(&device->predictor);
+}
+
+struct t503_device *t503_add_device(struct t503_context *ctx, struct t503_profile const *profile) {
+    if (ctx->n_devices == T503_MAX_DEVICES) return NULL;
+
+    struct t503_device *device = &ctx->devices[ctx->n_devices];
+    memset(device, 0, sizeof(*device));
+    device->ctx = ctx;
+    device->index = ctx->n_devices;
+    /* Everything that depends on the model is settled here, no report looks at it again */
+    device->profile = profile;
+    device->decode = t503_profile_decoder(profile);
+    t503_config_build_transform(ctx->config, profile, &device->transform);
+    device->pressure_scale = (uint32_t)((((uint64_t)T503_PRESSURE_LEVELS - 1) << T503_PRESSURE_SCALE_SHIFT)
+                                        / profile->max_pressure);
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) device->libusb_recovery[i].timer_fd = -1;
+
+    if (ctx->sink->open(device)) return NULL;
+    ctx->n_devices++;
+    return device;
 }
 
 int t503_loop(struct t503_context *ctx) {
-    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
-        libusb_submit_transfer(ctx->libusb_transfers[i]);
+    if (ctx->source->start(ctx)) {
+        errorf("Cannot start reading from %s\n", ctx->source->name);
+        return -1;
     }
 
-    struct timeval tm;
-    tm.tv_sec = 1;
-    tm.tv_usec = 0;
-    while (!s_should_exit) {
-        libusb_handle_events_timeout_completed(ctx->libusb_ctx, &tm, NULL);
+    /* Starting may allocate, from here on only reports are handled */
+    t503_alloc_guard_arm();
+    while (!ctx->reactor.should_exit) {
+        int timeout_ms = ctx->source->timeout_ms ? ctx->source->timeout_ms(ctx) : -1;
+        if (t503_reactor_run_once(&ctx->reactor, timeout_ms) < 0) break;
+        t503_end_open_frames(ctx);
     }
 
-    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
-        libusb_cancel_transfer(ctx->libusb_transfers[i]);
-        libusb_handle_events_timeout_completed(ctx->libusb_ctx, &tm, NULL);
-    }
+    t503_alloc_guard_disarm();
+    ctx->source->stop(ctx);
+    /* Reports of the transfers drained by stop */
+    t503_end_open_frames(ctx);
 
+    t503_print_stats(ctx);
     return 0;
-}
\ No newline at end of file
+}
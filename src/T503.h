@@ -3,7 +3,17 @@
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
 #include <linux/input-event-codes.h>
+#include <stdio.h>
+#include <time.h>
 
+#include "T503_config.h"
+#include "T503_export.h"
+#include "T503_predict.h"
+#include "T503_profile.h"
+#include "T503_reactor.h"
+#include "T503_stats.h"
+#include "T503_timebase.h"
+#include "T503_transport.h"
 #include "T503_key_settings.inc"
 
 #define T503_COUNT_OF(x) ((sizeof(x)/sizeof(0[x])) / ((size_t)(!(sizeof(x) % sizeof(0[x])))))
@@ -27,38 +37,350 @@ static const int g_mapping_4[] = {
     T503_BUTTON_4
 };
 
-#define T503_ID_VENDOR 0x8f2
-#define T503_ID_PRODUCT 0x6811
-#define T503_INTERFACE_1 1
-#define T503_INTERFACE_2 2
-#define T503_N_ENDPOINTS 2
+/* Longest report of the supported tablets */
 #define T503_IO_BUFFER_SIZE 8
 
-#define T503_MAX_X 4095
-#define T503_MAX_Y 4095
-#define T503_RESOLUTION_X 2
-#define T503_RESOLUTION_Y 3
+/* Tablets served at once by the libusb transport, hidraw and the mock source use a single one */
+#define T503_MAX_DEVICES 16
+
+_Static_assert(T503_STATS_N_ENDPOINTS == T503_N_ENDPOINTS, "statistics are kept per endpoint");
+
+/*
+ * Reactor handlers besides the tablets: signalfd, inotify, the libusb work timer and the pollfds libusb has
+ * before any tablet is open, the export socket and its readers, and the mock, probe or hidraw fds.
+ */
+#define T503_CONTEXT_HANDLERS (16 + T503_SHM_MAX_READERS)
+/* Each tablet adds the pollfd of its libusb handle and a recovery timer per endpoint */
+#define T503_DEVICE_HANDLERS (1 + T503_N_ENDPOINTS)
+_Static_assert(T503_REACTOR_MAX_HANDLERS >= T503_CONTEXT_HANDLERS + T503_MAX_DEVICES * T503_DEVICE_HANDLERS,
+               "the reactor must have room for every tablet");
+
+/* Interrupt transfers kept in flight per endpoint unless --transfers says otherwise */
+#ifndef T503_N_TRANSFERS
+#define T503_N_TRANSFERS 4
+#endif
+/* Most --transfers accepts, the transfers and their buffers are sized for it, override with -DT503_MAX_TRANSFERS=n */
+#ifndef T503_MAX_TRANSFERS
+#define T503_MAX_TRANSFERS 16
+#endif
+_Static_assert(T503_N_TRANSFERS >= 1 && T503_N_TRANSFERS <= T503_MAX_TRANSFERS,
+               "the default number of transfers must be one the pool can hold");
+
+/* Reported pressure, the pressure of other tablets is scaled to the levels of the pressure table */
 #define T503_MAX_PRESSURE 2047
+/* Fractional bits of t503_device.pressure_scale */
+#define T503_PRESSURE_SCALE_SHIFT 16
+_Static_assert(T503_MAX_PRESSURE + 1 == T503_PRESSURE_LEVELS, "the pressure table must cover every raw level");
+
+
+/*
+ * Input devices of a tablet: the stylus with its axes and buttons, and the pad whose buttons send
+ * the mapped keys. Compositors classify them apart and pen motion never goes through keyboard handling.
+ */
+enum t503_node {
+    T503_NODE_PEN,
+    T503_NODE_PAD,
+    T503_N_NODES,
+};
+
+/* Stylus buttons bound to pad buttons are sent by the stylus, like a pen button would be */
+static inline enum t503_node t503_key_node(uint16_t key) {
+    return key == BTN_STYLUS || key == BTN_STYLUS2 ? T503_NODE_PEN : T503_NODE_PAD;
+}
+
+/* Upper bound of events collected per node for one report before they are written to uinput */
+#define T503_FRAME_MAX_EVENTS 64
+
+/* Events of one frame, each node gets them in one write */
+struct t503_frame {
+    struct input_event events[T503_N_NODES][T503_FRAME_MAX_EVENTS];
+    size_t n_events[T503_N_NODES];
+
+    uint64_t n_writes;
+    uint64_t n_written;
+};
+
+/* Values of the pen in struct t503_pen_state, in the order they are written */
+enum t503_pen_axis {
+    T503_PEN_X,
+    T503_PEN_Y,
+    T503_PEN_PRESSURE,
+    /* BTN_TOOL_PEN while the pen is in range, and BTN_TOUCH while its tip is down */
+    T503_PEN_TOOL,
+    T503_PEN_TOUCH,
+    T503_PEN_N_AXES,
+};
+
+/*
+ * Pen values the sink last got, and newer ones still to be written. With coalescing, the frame of
+ * pen reports stays open until the end of the event loop pass and only keeps their latest values.
+ */
+struct t503_pen_state {
+    int32_t written[T503_PEN_N_AXES];
+    int32_t pending[T503_PEN_N_AXES];
+    /* Bits of the axes in pending */
+    uint8_t pending_mask;
+    /* Bits of the axes written at least once, the others are never redundant */
+    uint8_t written_valid;
+    uint8_t open;
+    /* Times of the first report of the open frame, its latency is measured when the frame is written */
+    uint64_t open_received_ns;
+    uint64_t open_decoded_ns;
+};
 
+/* Buffers the capture file is written through, about one write() per few hundred reports */
+#define T503_RECORD_BUFFER_SIZE 65536
+
+/*
+ * Everything the per-report path of a device writes to, allocated with the context so that
+ * no report ever calls malloc, see T503_ALLOC_GUARD.
+ */
+struct t503_arena {
+    uint8_t transfer_buffers[T503_N_ENDPOINTS][T503_MAX_TRANSFERS][T503_IO_BUFFER_SIZE];
+    struct t503_frame frame;
+};
+
+/* Delay before failed transfers are resubmitted, doubled after every failed attempt up to the maximum */
+#define T503_RECOVERY_MIN_NS 1000000ull
+#define T503_RECOVERY_MAX_NS 1000000000ull
+
+/* Maximum number of kernel event nodes grabbed while reading through hidraw */
+#define T503_MAX_GRABS 8
+
+/* Reports fed by the mock source per event loop iteration, each one to the device of its tablet */
+#define T503_MOCK_BATCH 256
+
+enum t503_transport {
+    T503_TRANSPORT_LIBUSB,
+    T503_TRANSPORT_HIDRAW,
+    T503_TRANSPORT_MOCK,
+};
+
+enum t503_sink {
+    T503_SINK_UINPUT,
+    T503_SINK_CAPTURE,
+};
+
+/* One raw report fed by the mock source, also the record layout of capture files */
+struct t503_mock_report {
+    uint64_t timestamp_ns;
+    uint8_t endpoint;
+    uint8_t length;
+    uint8_t data[T503_IO_BUFFER_SIZE];
+    /* Index of the tablet among those recorded together, zero in captures from before it was recorded */
+    uint8_t device;
+    uint8_t reserved[5];
+};
+
+struct t503_mock_source {
+    const struct t503_mock_report *reports;
+    size_t n_reports;
+    /* Times the reports are fed before the loop exits, 0 behaves like 1 */
+    size_t n_loops;
+    /* Keep the original spacing of the timestamps instead of feeding as fast as possible */
+    int realtime;
+
+    size_t position;
+    size_t loop;
+    uint64_t start_ns;
+    int timer_fd;
+};
+
+struct t503_capture_sink {
+    /* Captured events, may be NULL to only count them */
+    struct input_event *events;
+    size_t capacity;
+
+    size_t n_events;
+    size_t n_frames;
+    size_t n_dropped;
+};
+
+struct t503_options {
+    enum t503_transport transport;
+    enum t503_sink sink;
+    /* hidraw nodes for the interfaces of the profile, looked up in sysfs when NULL */
+    const char *hidraw_paths[T503_N_ENDPOINTS];
+    /* Used with T503_TRANSPORT_MOCK and T503_SINK_CAPTURE */
+    struct t503_mock_source *mock;
+    struct t503_capture_sink *capture;
+    /* Append every raw report to this capture file */
+    const char *record_path;
+    /* Key bindings, reloaded when the file changes, built-in bindings when NULL */
+    const char *config_path;
+    /* Tablets to use with libusb, as bus-port.port like in /sys/bus/usb/devices or that directory, all when none */
+    const char *usb_paths[T503_MAX_DEVICES];
+    size_t n_usb_paths;
+    /* Interrupt transfers in flight per endpoint with libusb, T503_N_TRANSFERS when 0 */
+    size_t n_transfers;
+    /* Print how long each step of the startup took */
+    int startup_timing;
+    /* Unix socket that hands the shared memory ring of decoded samples to readers */
+    const char *export_path;
+    /* Tablet the mock source and hidraw nodes given by path are, the T503 when NULL */
+    const struct t503_profile *profile;
+};
+
+/* Steps of t503_init() timed for t503_options.startup_timing */
+#define T503_MAX_STARTUP_STEPS 16
+
+struct t503_startup {
+    uint64_t start_ns;
+    uint64_t last_ns;
+    size_t n_steps;
+    const char *names[T503_MAX_STARTUP_STEPS];
+    uint64_t durations_ns[T503_MAX_STARTUP_STEPS];
+};
+
+struct t503_context;
+struct t503_device;
+
+struct t503_hidraw {
+    struct t503_context *ctx;
+    size_t endpoint;
+    int fd;
+};
+
+/* Failed transfers of one endpoint, waiting for the recovery timer to resubmit them */
+struct t503_libusb_recovery {
+    struct t503_device *device;
+    size_t endpoint;
+    int timer_fd;
+    /* The endpoint stalled and its halt must be cleared first */
+    int halted;
+    uint64_t backoff_ns;
+    size_t n_parked;
+    struct libusb_transfer *parked[T503_MAX_TRANSFERS];
+};
+
+struct t503_libusb_endpoints {
+    const struct t503_profile *profile;
+    uint8_t addresses[T503_N_ENDPOINTS];
+};
+
+/* Bus number followed by the port numbers, as returned by libusb_get_port_numbers() */
+#define T503_MAX_PORT_PATH 8
+
+/* One tablet with its own transfers, input device and statistics, all of them share the event loop */
+struct t503_device {
+    struct t503_context *ctx;
+    size_t index;
+    /* The model, it is the same for every tablet the device gets */
+    const struct t503_profile *profile;
+    t503_decode_fn decode;
+    /* Active area of the configuration on this model, and its raw pressure to pressure table levels */
+    struct t503_transform transform;
+    uint32_t pressure_scale;
+
+    /* Where the last tablet of this device was plugged, it gets the same input device back */
+    uint8_t port_path[T503_MAX_PORT_PATH];
+    int port_path_length;
+
+    /* The attached tablet, the handle is NULL while it is unplugged */
+    libusb_device *libusb_device;
+    libusb_device_handle *libusb_handle;
+    struct libusb_transfer *libusb_transfers[T503_N_ENDPOINTS][T503_MAX_TRANSFERS];
+    size_t libusb_inflight;
+    struct t503_libusb_recovery libusb_recovery[T503_N_ENDPOINTS];
+    uint8_t libusb_endpoint_addresses[T503_N_ENDPOINTS];
+    int libusb_departed;
+    /* Transfers of the departed tablet are being cancelled before it is closed */
+    int libusb_detaching;
+
+    struct libevdev *libevdev_dev[T503_N_NODES];
+    struct libevdev_uinput *libevdev_uidev[T503_N_NODES];
+
+    struct t503_arena arena;
+    struct t503_stats stats;
+    struct t503_predictor predictor;
+    struct t503_pen_state pen;
+    struct t503_timebase timebase[T503_N_ENDPOINTS];
+    /* Timebase time of the last report of the open frame, sent with it as MSC_TIMESTAMP */
+    uint64_t frame_time_ns;
+    /* Pressed pad buttons as T503_BUTTON_BIT_* */
+    uint8_t buttons;
+    /* Pressed buttons mapped to each key, a key is down while its count is not zero */
+    uint8_t key_refs[KEY_CNT];
+};
 
 struct t503_context {
+    struct t503_reactor reactor;
+    int signal_fd;
+
+    const struct t503_source_ops *source;
+    const struct t503_sink_ops *sink;
+
+    struct t503_hidraw hidraw[T503_N_ENDPOINTS];
+    int hidraw_grab_fds[T503_MAX_GRABS];
+    size_t hidraw_n_grabs;
+
+    struct t503_mock_source *mock;
+    struct t503_capture_sink *capture;
+    FILE *record;
+    char record_buffer[T503_RECORD_BUFFER_SIZE];
+
     libusb_context *libusb_ctx;
-    libusb_device_handle *libusb_handle;
-    struct libusb_config_descriptor *libusb_config;
-    struct libusb_transfer *libusb_transfers[T503_N_ENDPOINTS];
+    int libusb_stopping;
+    int libusb_started;
+    /* Interrupt transfers of each endpoint, only the first ones of the pool are used */
+    size_t libusb_n_transfers;
+    /* A pollfd libusb added could not be watched, set by the notifier and checked by whoever made libusb add it */
+    int libusb_poll_failed;
 
-    uint8_t libusb_endpoint_addresses[T503_N_ENDPOINTS];
+    /* Hotplug events are only recorded by the callback, the work timer acts on them from the loop */
+    libusb_hotplug_callback_handle libusb_hotplug;
+    int libusb_hotplug_registered;
+    int libusb_work_timer_fd;
+    /* Tablets that showed up and wait to be attached to a device */
+    libusb_device *libusb_arrived[T503_MAX_DEVICES];
+    size_t libusb_n_arrived;
+    /* Only tablets plugged at these bus and port numbers are used, any when there are none */
+    uint8_t libusb_paths[T503_MAX_DEVICES][T503_MAX_PORT_PATH];
+    int libusb_path_lengths[T503_MAX_DEVICES];
+    size_t libusb_n_paths;
+    /* Endpoint addresses of each model, read from the descriptor of the first of its tablets only */
+    struct t503_libusb_endpoints libusb_endpoints[T503_MAX_DEVICES];
+    size_t libusb_n_endpoints;
 
-    struct libevdev *libevdev_dev;
-    struct libevdev_uinput *libevdev_uidev;
+    /* The active configuration and a spare one that reloads are parsed into */
+    struct t503_config configs[2];
+    struct t503_config *config;
+    const char *config_path;
+    int inotify_fd;
+    /* Keys enabled on the uinput devices, fixed once the first one is created */
+    uint8_t key_caps[(KEY_CNT + 7) / 8];
 
-    
-    uint8_t buffer[T503_N_ENDPOINTS][T503_IO_BUFFER_SIZE];
-    const int *prev_mapping;
-    size_t prev_mapping_len;
+    /* Devices added so far, they are kept until exit so that a tablet coming back reuses its own */
+    struct t503_device devices[T503_MAX_DEVICES];
+    size_t n_devices;
 
+    struct t503_export export;
+
+    /* Expiration to callback of the real-time probe timer, empty unless it runs */
+    struct t503_histogram wakeup;
+    struct t503_startup startup;
 };
 
-int t503_init(struct t503_context *);
+static inline uint64_t t503_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int t503_init(struct t503_context *, struct t503_options const *);
 void t503_exit(struct t503_context *);
 int t503_loop(struct t503_context *);
+
+/*
+ * Decode one raw report read from the given endpoint and emit it, shared by all sources.
+ * received_ns is the t503_now_ns() of the moment the source got the report, latencies are measured from it.
+ */
+void t503_handle_report(struct t503_device *, size_t endpoint, const uint8_t *data, int length, uint64_t received_ns);
+/* Switch to another configuration, buttons held down keep being held under the new bindings */
+void t503_apply_config(struct t503_context *, struct t503_config *);
+/* Release every button and lift the pen, for sources that lose their tablet */
+void t503_release_all(struct t503_device *);
+/* Take the next free device for a model and open its sink, NULL once all T503_MAX_DEVICES are in use */
+struct t503_device *t503_add_device(struct t503_context *, struct t503_profile const *);
+/* End a startup step, its duration is measured from the end of the previous one */
+void t503_startup_step(struct t503_context *, const char *name);
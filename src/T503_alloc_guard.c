@@ -0,0 +1,80 @@
+#include "T503_alloc_guard.h"
+
+#ifdef T503_ALLOC_GUARD
+#include <errno.h>
+#include <stdio.h>
+
+/* The glibc allocator under its internal names */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+/* Per thread, so that the logger thread and the main thread may still allocate */
+static __thread int s_armed;
+static size_t s_count;
+static void *s_first_caller;
+
+
+static void t503_alloc_guard_hit(void *caller) {
+    if (!s_armed) return;
+    if (__atomic_fetch_add(&s_count, 1, __ATOMIC_RELAXED) == 0) s_first_caller = caller;
+}
+
+void *malloc(size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    t503_alloc_guard_hit(__builtin_return_address(0));
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+void t503_alloc_guard_arm(void) {
+    s_armed = 1;
+}
+
+int t503_alloc_guard_disarm(void) {
+    int armed = s_armed;
+    s_armed = 0;
+    return armed;
+}
+
+int t503_alloc_guard_report(void) {
+    size_t count = __atomic_load_n(&s_count, __ATOMIC_RELAXED);
+    if (!count) {
+        fprintf(stdout, "alloc guard: no allocation on the event loop\n");
+        return 0;
+    }
+    fprintf(stderr, "alloc guard: %zu allocations on the event loop, the first one from %p\n",
+        count, s_first_caller);
+    return -1;
+}
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * Built with -DT503_ALLOC_GUARD, malloc and friends are interposed and every allocation made by
+ * the event loop between t503_alloc_guard_arm() and t503_alloc_guard_disarm() is counted.
+ * Replaying a capture with such a build checks that the per-report path never allocates.
+ * Otherwise all of these compile to nothing.
+ */
+#ifdef T503_ALLOC_GUARD
+void t503_alloc_guard_arm(void);
+/* Returns whether the guard was armed, for code that may allocate and runs on the event loop */
+int t503_alloc_guard_disarm(void);
+/* Prints the allocations counted so far, returns -1 if there were any */
+int t503_alloc_guard_report(void);
+#else
+static inline void t503_alloc_guard_arm(void) {}
+static inline int t503_alloc_guard_disarm(void) { return 0; }
+static inline int t503_alloc_guard_report(void) { return 0; }
+#endif
@@ -0,0 +1,507 @@
+#include "T503_bench.h"
+#include "T503_decode.h"
+#include "T503_predict.h"
+#include "T503_shm.h"
+#include "T503_timebase.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+
+static void t503_bench_print(const char *name, size_t n_items, uint64_t elapsed_ns, uint64_t checksum) {
+    fprintf(stdout, "%s: %zu reports in %.3f ms, %.1f M reports/s, %.2f ns/report (checksum %llx)\n",
+        name, n_items, elapsed_ns / 1e6,
+        elapsed_ns ? n_items * 1e3 / elapsed_ns : 0.0,
+        n_items ? (double)elapsed_ns / n_items : 0.0,
+        (unsigned long long)checksum);
+}
+
+int t503_bench_decode(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                      struct t503_profile const *profile) {
+    t503_decode_fn decode = t503_profile_decoder(profile);
+    struct t503_report report;
+    uint64_t checksum = 0;
+
+    if (!n_reports) return -1;
+    if (!n_loops) n_loops = 1;
+
+    uint64_t start_ns = t503_now_ns();
+    for (size_t loop = 0; loop < n_loops; loop++) {
+        for (size_t i = 0; i < n_reports; i++) {
+            decode(reports[i].data, reports[i].length, &report);
+            /* Keeps the decoded state alive so the loop cannot be optimized away */
+            checksum += report.buttons + report.pen + report.x + report.y + report.pressure;
+        }
+    }
+    uint64_t elapsed_ns = t503_now_ns() - start_ns;
+
+    t503_bench_print("decode", n_reports * n_loops, elapsed_ns, checksum);
+    return 0;
+}
+
+int t503_bench_pressure(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                        struct t503_profile const *profile, struct t503_config const *config) {
+    t503_decode_fn decode = t503_profile_decoder(profile);
+    struct t503_report report;
+    uint64_t checksum = 0;
+
+    if (!n_reports) return -1;
+    if (!n_loops) n_loops = 1;
+
+    uint64_t start_ns = t503_now_ns();
+    for (size_t loop = 0; loop < n_loops; loop++) {
+        for (size_t i = 0; i < n_reports; i++) {
+            decode(reports[i].data, reports[i].length, &report);
+            checksum += report.pressure;
+        }
+    }
+    uint64_t elapsed_ns = t503_now_ns() - start_ns;
+    t503_bench_print("passthrough", n_reports * n_loops, elapsed_ns, checksum);
+
+    checksum = 0;
+    start_ns = t503_now_ns();
+    for (size_t loop = 0; loop < n_loops; loop++) {
+        for (size_t i = 0; i < n_reports; i++) {
+            decode(reports[i].data, reports[i].length, &report);
+            checksum += t503_config_pressure(config, report.pressure);
+        }
+    }
+    elapsed_ns = t503_now_ns() - start_ns;
+    t503_bench_print("pressure curve", n_reports * n_loops, elapsed_ns, checksum);
+    return 0;
+}
+
+struct t503_bench_sample {
+    uint64_t t_ns;
+    uint16_t x;
+    uint16_t y;
+    /* Samples of a stroke share the index of its first sample */
+    size_t stroke;
+};
+
+/* Actual position of the stroke of sample i at t_ns, interpolated between the samples around it */
+static int t503_bench_actual(const struct t503_bench_sample *samples, size_t n_samples, size_t i, uint64_t t_ns,
+                             double actual[2]) {
+    size_t j = i;
+    while (j + 1 < n_samples && samples[j + 1].stroke == samples[i].stroke && samples[j + 1].t_ns < t_ns) j++;
+    if (j + 1 == n_samples || samples[j + 1].stroke != samples[i].stroke) return -1;
+
+    const struct t503_bench_sample *a = &samples[j], *b = &samples[j + 1];
+    double f = (double)(t_ns - a->t_ns) / (b->t_ns - a->t_ns);
+    actual[0] = a->x + f * (b->x - a->x);
+    actual[1] = a->y + f * (b->y - a->y);
+    return 0;
+}
+
+static double t503_bench_distance_mm(struct t503_profile const *profile, double x, double y, const double actual[2]) {
+    return hypot((x - actual[0]) / profile->resolution_x, (y - actual[1]) / profile->resolution_y);
+}
+
+static int t503_bench_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void t503_bench_print_error(const char *name, double *errors, size_t n_errors, const char *unit) {
+    double sum = 0;
+    for (size_t i = 0; i < n_errors; i++) sum += errors[i];
+    qsort(errors, n_errors, sizeof(double), t503_bench_compare_double);
+    fprintf(stdout, "%s: %zu samples, error mean %.3f %s, p50 %.3f %s, p95 %.3f %s, max %.3f %s\n",
+        name, n_errors, n_errors ? sum / n_errors : 0.0, unit,
+        n_errors ? errors[n_errors / 2] : 0.0, unit,
+        n_errors ? errors[n_errors * 95 / 100] : 0.0, unit,
+        n_errors ? errors[n_errors - 1] : 0.0, unit);
+}
+
+int t503_bench_prediction(const struct t503_mock_report *reports, size_t n_reports,
+                          struct t503_profile const *profile, struct t503_config const *config) {
+    t503_decode_fn decode = t503_profile_decoder(profile);
+    uint16_t const max[2] = { profile->max_x, profile->max_y };
+    struct t503_bench_sample *samples = malloc(n_reports * sizeof(*samples));
+    double *errors = malloc(2 * n_reports * sizeof(*errors));
+    struct t503_predictor predictor;
+    struct t503_report report;
+    size_t n_samples = 0, n_errors = 0;
+    int retn = -1;
+
+    if (!samples || !errors) goto out;
+
+    /* Pen positions with their recorded timestamps, split into strokes like the driver does */
+    size_t stroke = 0;
+    for (size_t i = 0; i < n_reports; i++) {
+        if (decode(reports[i].data, reports[i].length, &report) || report.kind != T503_REPORT_PEN) continue;
+        if (!(report.pen & T503_PEN_MOVE)) {
+            stroke = n_samples;
+            continue;
+        }
+        uint64_t t_ns = reports[i].timestamp_ns;
+        if (n_samples && (t_ns <= samples[n_samples - 1].t_ns
+                          || t_ns - samples[n_samples - 1].t_ns > T503_PREDICT_MAX_GAP_NS)) {
+            stroke = n_samples;
+        }
+        samples[n_samples++] = (struct t503_bench_sample){ t_ns, report.x, report.y, stroke };
+    }
+
+    /* Both are compared with where the pen actually was one lead later, without prediction that is the lag */
+    double *predicted = errors, *lagging = errors + n_reports;
+    t503_predictor_reset(&predictor);
+    for (size_t i = 0; i < n_samples; i++) {
+        uint16_t out[2];
+        double actual[2];
+        if (i && samples[i].stroke != samples[i - 1].stroke) t503_predictor_reset(&predictor);
+        t503_predict(&predictor, &config->prediction, samples[i].t_ns, samples[i].x, samples[i].y, max, out);
+        if (t503_bench_actual(samples, n_samples, i, samples[i].t_ns + config->prediction.lead_ns, actual)) continue;
+        predicted[n_errors] = t503_bench_distance_mm(profile, out[0], out[1], actual);
+        lagging[n_errors] = t503_bench_distance_mm(profile, samples[i].x, samples[i].y, actual);
+        n_errors++;
+    }
+
+    fprintf(stdout, "%zu pen positions, %s %.1f ms ahead\n", n_samples,
+        config->prediction.mode == T503_PREDICT_ACCELERATION ? "acceleration"
+        : config->prediction.mode == T503_PREDICT_VELOCITY ? "velocity" : "no extrapolation",
+        config->prediction.lead_ns / 1e6);
+    t503_bench_print_error("no prediction", lagging, n_errors, "mm");
+    t503_bench_print_error("prediction", predicted, n_errors, "mm");
+    retn = 0;
+
+out:
+    free(samples);
+    free(errors);
+    return retn;
+}
+
+/* Distance of an interval from the nearest whole number of periods */
+static double t503_bench_period_error_us(uint64_t interval_ns, double period_ns) {
+    double n_periods = round(interval_ns / period_ns);
+    if (n_periods < 1) n_periods = 1;
+    return fabs(interval_ns - n_periods * period_ns) / 1e3;
+}
+
+/* Reports of one endpoint of one tablet */
+static size_t t503_bench_stream(const struct t503_mock_report *report) {
+    return (size_t)report->device * T503_N_ENDPOINTS + report->endpoint % T503_N_ENDPOINTS;
+}
+
+int t503_bench_timebase(const struct t503_mock_report *reports, size_t n_reports) {
+    double *intervals = malloc(n_reports * sizeof(*intervals));
+    double *errors = malloc(2 * n_reports * sizeof(*errors));
+    uint64_t *times = malloc(n_reports * sizeof(*times));
+    int retn = -1;
+
+    if (!intervals || !errors || !times) goto out;
+
+    /* The timebase time of every report, as the driver sends it, every endpoint of every tablet has its own */
+    static struct t503_timebase timebase[T503_MAX_DEVICES * T503_N_ENDPOINTS];
+    size_t n_streams = 0;
+    for (size_t s = 0; s < T503_COUNT_OF(timebase); s++) t503_timebase_reset(&timebase[s]);
+    for (size_t i = 0; i < n_reports; i++) {
+        size_t s = t503_bench_stream(&reports[i]);
+        if (s >= T503_COUNT_OF(timebase)) continue;
+        if (s >= n_streams) n_streams = s + 1;
+        times[i] = t503_timebase_update(&timebase[s], reports[i].timestamp_ns);
+    }
+
+    for (size_t s = 0; s < n_streams; s++) {
+        /* The period of the tablet is taken as the median of the completion intervals */
+        size_t n_intervals = 0, previous = n_reports;
+        for (size_t i = 0; i < n_reports; i++) {
+            if (t503_bench_stream(&reports[i]) != s) continue;
+            if (previous < n_reports && reports[i].timestamp_ns > reports[previous].timestamp_ns
+                && reports[i].timestamp_ns - reports[previous].timestamp_ns <= T503_TIMEBASE_RESET_NS) {
+                intervals[n_intervals++] = reports[i].timestamp_ns - reports[previous].timestamp_ns;
+            }
+            previous = i;
+        }
+        if (n_intervals < 2) continue;
+        qsort(intervals, n_intervals, sizeof(double), t503_bench_compare_double);
+        double period_ns = intervals[n_intervals / 2];
+
+        double *received = errors, *smoothed = errors + n_reports;
+        size_t n_errors = 0;
+        previous = n_reports;
+        for (size_t i = 0; i < n_reports; i++) {
+            if (t503_bench_stream(&reports[i]) != s) continue;
+            if (previous < n_reports && reports[i].timestamp_ns > reports[previous].timestamp_ns
+                && reports[i].timestamp_ns - reports[previous].timestamp_ns <= T503_TIMEBASE_RESET_NS) {
+                received[n_errors] = t503_bench_period_error_us(
+                    reports[i].timestamp_ns - reports[previous].timestamp_ns, period_ns);
+                smoothed[n_errors] = t503_bench_period_error_us(times[i] - times[previous], period_ns);
+                n_errors++;
+            }
+            previous = i;
+        }
+
+        fprintf(stdout, "device %zu endpoint %zu: %zu intervals, period %.1f us\n",
+            s / T503_N_ENDPOINTS, s % T503_N_ENDPOINTS, n_errors, period_ns / 1e3);
+        t503_bench_print_error("completion time", received, n_errors, "us");
+        t503_bench_print_error("timebase", smoothed, n_errors, "us");
+    }
+    retn = 0;
+
+out:
+    free(intervals);
+    free(errors);
+    free(times);
+    return retn;
+}
+
+/* Readers of the export benchmark, each spins on the ring until the producer is done */
+#define T503_BENCH_READERS 2
+/* The producer waits for the slowest reader beyond this many samples, so that none is overrun */
+#define T503_BENCH_MAX_LAG (T503_SHM_SLOTS / 2)
+
+struct t503_bench_reader {
+    struct t503_shm_reader reader;
+    const int *done;
+    /* Next sample to read, published for the producer */
+    uint64_t progress;
+    uint64_t n_read;
+    uint64_t checksum;
+    uint64_t elapsed_ns;
+};
+
+static void *t503_bench_reader_thread(void *arg) {
+    struct t503_bench_reader *bench = (struct t503_bench_reader *)arg;
+    struct t503_shm_sample sample;
+
+    uint64_t start_ns = t503_now_ns();
+    for (;;) {
+        /* Checked before reading, so that the samples published before the end are all read */
+        int done = __atomic_load_n(bench->done, __ATOMIC_ACQUIRE);
+        while (t503_shm_read(&bench->reader, &sample)) {
+            bench->n_read++;
+            bench->checksum += sample.x + sample.y + sample.pressure;
+            __atomic_store_n(&bench->progress, bench->reader.next, __ATOMIC_RELEASE);
+        }
+        if (done) break;
+    }
+    bench->elapsed_ns = t503_now_ns() - start_ns;
+    return NULL;
+}
+
+/* Spins until every reader is at most T503_BENCH_MAX_LAG samples behind head, returns whether it had to */
+static int t503_bench_pace(struct t503_bench_reader *readers, size_t n_readers, uint64_t head) {
+    int waited = 0;
+    for (size_t i = 0; i < n_readers; i++) {
+        while (head - __atomic_load_n(&readers[i].progress, __ATOMIC_ACQUIRE) >= T503_BENCH_MAX_LAG) waited = 1;
+    }
+    return waited;
+}
+
+int t503_bench_export(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                      struct t503_profile const *profile) {
+    t503_decode_fn decode = t503_profile_decoder(profile);
+    struct t503_bench_reader readers[T503_BENCH_READERS];
+    pthread_t threads[T503_BENCH_READERS];
+    struct t503_report report;
+    uint64_t checksum = 0;
+    uint64_t n_waits = 0;
+    int done = 0;
+    size_t n_threads = 0;
+
+    if (!n_reports) return -1;
+    if (!n_loops) n_loops = 1;
+
+    /* Mapped like the memfd of the daemon rather than allocated */
+    struct t503_shm_ring *ring = mmap(NULL, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) return -1;
+    t503_shm_init(ring);
+
+    for (; n_threads < T503_BENCH_READERS; n_threads++) {
+        struct t503_bench_reader *bench = &readers[n_threads];
+        t503_shm_reader_init(&bench->reader, ring);
+        bench->done = &done;
+        bench->progress = 0;
+        bench->n_read = 0;
+        bench->checksum = 0;
+        if (pthread_create(&threads[n_threads], NULL, t503_bench_reader_thread, bench)) break;
+    }
+
+    uint64_t start_ns = t503_now_ns();
+    for (size_t loop = 0; loop < n_loops; loop++) {
+        for (size_t i = 0; i < n_reports; i++) {
+            decode(reports[i].data, reports[i].length, &report);
+            struct t503_shm_sample sample = {
+                0, reports[i].timestamp_ns, report.x, report.y, report.pressure,
+                report.buttons, report.buttons_valid, report.pen, report.kind, 0, { 0 }
+            };
+            n_waits += t503_bench_pace(readers, n_threads, ring->head);
+            t503_shm_write(ring, &sample);
+            checksum += report.x + report.y + report.pressure;
+        }
+    }
+    uint64_t elapsed_ns = t503_now_ns() - start_ns;
+    __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+    t503_bench_print("publish", n_reports * n_loops, elapsed_ns, checksum);
+    fprintf(stdout, "publish: waited %llu times for a reader %d samples behind\n", (unsigned long long)n_waits,
+        T503_BENCH_MAX_LAG);
+    for (size_t i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+        fprintf(stdout, "reader %zu: %llu of %llu samples read, %llu lost in %llu overruns, %.1f M samples/s "
+            "(checksum %llx)\n", i, (unsigned long long)readers[i].n_read, (unsigned long long)ring->head,
+            (unsigned long long)readers[i].reader.lost, (unsigned long long)readers[i].reader.overruns,
+            readers[i].elapsed_ns ? readers[i].n_read * 1e3 / readers[i].elapsed_ns : 0.0,
+            (unsigned long long)readers[i].checksum);
+    }
+    munmap(ring, sizeof(*ring));
+    return n_threads == T503_BENCH_READERS ? 0 : -1;
+}
+
+/* Replays the reports through the driver into the capture sink of the options, every report as its own frame */
+static int t503_bench_emit(struct t503_options const *opts) {
+    static struct t503_context ctx;
+    if (t503_init(&ctx, opts)) return -1;
+
+    ctx.config->filter.coalesce = 0;
+    for (size_t i = 0; i < opts->mock->n_reports; i++) {
+        const struct t503_mock_report *report = &opts->mock->reports[i];
+        t503_handle_report(&ctx.devices[report->device], report->endpoint % T503_N_ENDPOINTS, report->data,
+                           report->length, t503_now_ns());
+    }
+    t503_exit(&ctx);
+    return 0;
+}
+
+/*
+ * Device that accepts every event of the frames, so that uinput handles each of them like the driver's own.
+ * Its event node is grabbed through grab_fd, the replayed keys and strokes must not reach the desktop.
+ */
+static struct libevdev_uinput *t503_bench_uinput(const struct input_event *events, size_t n_events, int *grab_fd) {
+    struct input_absinfo absinfo = { 0, 0, UINT16_MAX, 0, 0, 0 };
+    struct libevdev_uinput *uidev = NULL;
+    struct libevdev *dev = libevdev_new();
+    if (!dev) return NULL;
+
+    libevdev_set_name(dev, "T503 write benchmark");
+    for (size_t i = 0; i < n_events; i++) {
+        if (events[i].type == EV_SYN) continue;
+        libevdev_enable_event_code(dev, events[i].type, events[i].code, events[i].type == EV_ABS ? &absinfo : NULL);
+    }
+    if (libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev)) uidev = NULL;
+    libevdev_free(dev);
+    if (!uidev) return NULL;
+
+    const char *devnode = libevdev_uinput_get_devnode(uidev);
+    *grab_fd = devnode ? open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC) : -1;
+    if (*grab_fd == -1 || ioctl(*grab_fd, EVIOCGRAB, (void *)1)) {
+        if (*grab_fd != -1) close(*grab_fd);
+        *grab_fd = -1;
+        libevdev_uinput_destroy(uidev);
+        return NULL;
+    }
+    return uidev;
+}
+
+/* Empties the pipe the benchmark writes to until its write end is closed */
+static void *t503_bench_drain_thread(void *arg) {
+    int fd = *(const int *)arg;
+    char buffer[65536];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {}
+    return NULL;
+}
+
+static uint64_t t503_bench_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Writes the frames n_loops times, one write() per event or one per frame, returns -1 on a failed write */
+static int t503_bench_write_frames(int fd, const struct input_event *events, size_t n_events, size_t n_loops,
+                                   int per_event, const char *name, size_t n_frames) {
+    uint64_t n_writes = 0;
+    uint64_t start_ns = t503_now_ns();
+    uint64_t start_cpu_ns = t503_bench_cpu_ns();
+    for (size_t loop = 0; loop < n_loops; loop++) {
+        size_t start = 0;
+        for (size_t i = 0; i < n_events; i++) {
+            if (!per_event && events[i].type != EV_SYN) continue;
+            size_t size = (i + 1 - start) * sizeof(struct input_event);
+            if (write(fd, &events[start], size) != (ssize_t)size) {
+                fprintf(stderr, "write: %s\n", strerror(errno));
+                return -1;
+            }
+            n_writes++;
+            start = i + 1;
+        }
+    }
+    uint64_t elapsed_cpu_ns = t503_bench_cpu_ns() - start_cpu_ns;
+    uint64_t elapsed_ns = t503_now_ns() - start_ns;
+
+    n_frames *= n_loops;
+    fprintf(stdout, "%s: %llu writes in %.3f ms, %.1f ns/frame, %.1f ns/frame of CPU time\n",
+        name, (unsigned long long)n_writes, elapsed_ns / 1e6,
+        n_frames ? (double)elapsed_ns / n_frames : 0.0,
+        n_frames ? (double)elapsed_cpu_ns / n_frames : 0.0);
+    return 0;
+}
+
+int t503_bench_write(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                     struct t503_profile const *profile, const char *config_path) {
+    struct t503_mock_source mock = { .reports = reports, .n_reports = n_reports, .n_loops = 1 };
+    struct t503_capture_sink capture = { .events = NULL };
+    struct t503_options opts = {
+        .transport = T503_TRANSPORT_MOCK,
+        .sink = T503_SINK_CAPTURE,
+        .mock = &mock,
+        .capture = &capture,
+        .config_path = config_path,
+        .profile = profile,
+    };
+    struct libevdev_uinput *uidev = NULL;
+    pthread_t drain;
+    int fds[2] = { -1, -1 };
+    int grab_fd = -1;
+    int retn = -1;
+
+    if (!n_reports) return -1;
+    if (!n_loops) n_loops = 1;
+
+    /* Counted first, then captured from a fresh start so that both runs emit the same */
+    if (t503_bench_emit(&opts)) return -1;
+    size_t n_events = capture.n_dropped;
+    capture.events = malloc(n_events * sizeof(struct input_event));
+    capture.capacity = n_events;
+    if (!capture.events || t503_bench_emit(&opts)) goto out;
+
+    size_t n_frames = 0;
+    for (size_t i = 0; i < n_events; i++) n_frames += capture.events[i].type == EV_SYN;
+
+    /* uinput when it can be opened, otherwise a pipe that a thread keeps empty */
+    int fd;
+    uidev = t503_bench_uinput(capture.events, n_events, &grab_fd);
+    if (uidev) {
+        fd = libevdev_uinput_get_fd(uidev);
+    } else {
+        if (pipe(fds)) goto out;
+        if (pthread_create(&drain, NULL, t503_bench_drain_thread, &fds[0])) goto out;
+        fd = fds[1];
+    }
+    fprintf(stdout, "%zu frames of %.1f events on average, written to %s\n", n_frames,
+        n_frames ? (double)n_events / n_frames : 0.0, uidev ? "uinput" : "a pipe, uinput cannot be opened");
+
+    retn = t503_bench_write_frames(fd, capture.events, n_events, n_loops, 1, "per event", n_frames);
+    if (!retn) retn = t503_bench_write_frames(fd, capture.events, n_events, n_loops, 0, "per frame", n_frames);
+
+    if (!uidev) {
+        close(fds[1]);
+        fds[1] = -1;
+        pthread_join(drain, NULL);
+    }
+
+out:
+    if (grab_fd != -1) close(grab_fd);
+    if (uidev) libevdev_uinput_destroy(uidev);
+    if (fds[1] != -1) close(fds[1]);
+    if (fds[0] != -1) close(fds[0]);
+    free(capture.events);
+    return retn;
+}
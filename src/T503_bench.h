@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+
+#include "T503.h"
+
+/* Microbenchmarks over recorded reports of one model of tablet, each prints its throughput to stdout */
+int t503_bench_decode(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                      struct t503_profile const *profile);
+/* Decodes with the raw pressure passed through, then with the pressure table of the configuration */
+int t503_bench_pressure(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                        struct t503_profile const *profile, struct t503_config const *config);
+/* Publishes the decoded reports into a shared memory ring as fast as two reader threads consume them */
+int t503_bench_export(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                      struct t503_profile const *profile);
+/*
+ * Replays the reports through the driver and times writing the frames it emitted with one write() per event,
+ * then with one write() per frame, to a grabbed uinput device or to a pipe when uinput cannot be opened.
+ */
+int t503_bench_write(const struct t503_mock_report *reports, size_t n_reports, size_t n_loops,
+                     struct t503_profile const *profile, const char *config_path);
+/*
+ * Not a timing: feeds the recorded pen positions through the predictor of the configuration and prints
+ * how far its output is from where the pen really was one lead later, along with the error of no prediction.
+ */
+int t503_bench_prediction(const struct t503_mock_report *reports, size_t n_reports,
+                          struct t503_profile const *profile, struct t503_config const *config);
+/*
+ * Not a timing: measures how far apart the reports of each endpoint are from whole periods of the tablet,
+ * with the completion times and with the timebase sent as MSC_TIMESTAMP.
+ */
+int t503_bench_timebase(const struct t503_mock_report *reports, size_t n_reports);
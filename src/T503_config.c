@@ -0,0 +1,607 @@
+#include "T503.h"
+#include "T503_config.h"
+#include "T503_alloc_guard.h"
+#include "T503_log.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#define T503_CONFIG_LINE_SIZE 512
+/* Largest output range, keeps the coefficients of the transform far from overflowing */
+#define T503_MAX_OUTPUT 65536
+/* Beyond this the extrapolation is mostly noise */
+#define T503_MAX_PREDICTION_MS 50
+/* Lead of prediction when it is enabled without prediction_ms */
+#define T503_DEFAULT_PREDICTION_MS 8
+
+static void inotify_cb(void *, uint32_t);
+
+static const char *const s_button_names[T503_N_BUTTONS] = {
+    "button_1",
+    "button_2",
+    "button_3",
+    "button_4",
+    "button_plus",
+    "button_minus",
+};
+
+/* Shapes of pressure_curve, soft and hard are gamma curves with a fixed exponent */
+static const struct {
+    const char *name;
+    enum t503_pressure_shape shape;
+    size_t n_params;
+    double gamma;
+} s_pressure_shapes[] = {
+    { "linear", T503_PRESSURE_LINEAR, 0, 0 },
+    { "soft", T503_PRESSURE_GAMMA, 0, 0.5 },
+    { "hard", T503_PRESSURE_GAMMA, 0, 2.0 },
+    { "gamma", T503_PRESSURE_GAMMA, 1, 0 },
+    { "bezier", T503_PRESSURE_BEZIER, 4, 0 },
+};
+
+
+static void t503_keymap_set(struct t503_keymap *keymap, size_t button, const int *keys, size_t n_keys) {
+    keymap->n_keys[button] = n_keys;
+    for (size_t i = 0; i < n_keys; i++) {
+        keymap->keys[button][i] = keys[i];
+    }
+}
+
+static const char *const s_predict_modes[] = {
+    [T503_PREDICT_OFF] = "off",
+    [T503_PREDICT_VELOCITY] = "velocity",
+    [T503_PREDICT_ACCELERATION] = "acceleration",
+};
+
+/* One coordinate of the cubic Bezier curve from 0 to 1 with inner control points p1 and p2 */
+static double t503_bezier(double p1, double p2, double s) {
+    double r = 1 - s;
+    return 3 * r * r * s * p1 + 3 * r * s * s * p2 + s * s * s;
+}
+
+static double t503_pressure_curve_eval(struct t503_pressure_curve const *curve, double x) {
+    switch (curve->shape) {
+    case T503_PRESSURE_GAMMA:
+        return pow(x, curve->params[0]);
+    case T503_PRESSURE_BEZIER: {
+        /* x grows with s as long as both control points have x in [0, 1], so bisect on it */
+        double lo = 0, hi = 1;
+        for (int i = 0; i < 40; i++) {
+            double s = (lo + hi) / 2;
+            if (t503_bezier(curve->params[0], curve->params[2], s) < x) lo = s; else hi = s;
+        }
+        return t503_bezier(curve->params[1], curve->params[3], (lo + hi) / 2);
+    }
+    default:
+        return x;
+    }
+}
+
+/* Evaluates the curve once per raw level so that a report only costs a load from the table */
+static void t503_config_build_pressure(struct t503_config *config) {
+    struct t503_pressure_curve const *curve = &config->pressure_curve;
+
+    for (size_t raw = 0; raw < T503_PRESSURE_LEVELS; raw++) {
+        double x = raw <= curve->min ? 0 : raw >= curve->max ? 1
+            : (double)(raw - curve->min) / (curve->max - curve->min);
+        double y = t503_pressure_curve_eval(curve, x);
+        if (y < 0) y = 0;
+        if (y > 1) y = 1;
+        config->pressure[raw] = (uint16_t)lround(y * (T503_PRESSURE_LEVELS - 1));
+    }
+}
+
+static void t503_mapping_default(struct t503_mapping *mapping) {
+    memset(mapping, 0, sizeof(*mapping));
+}
+
+/* Output position from 0 to 1 along each axis as a combination of the position a, b in the area and 1 */
+static const double s_rotations[4][2][3] = {
+    { { 1, 0, 0 }, { 0, 1, 0 } },
+    { { 0, -1, 1 }, { 1, 0, 0 } },
+    { { -1, 0, 1 }, { 0, -1, 1 } },
+    { { 0, 1, 0 }, { -1, 0, 1 } },
+};
+
+/* Folds cropping, rotation and scaling into one transform, the default mapping reports the tablet as before */
+void t503_config_build_transform(struct t503_config const *config, struct t503_profile const *profile,
+                                 struct t503_transform *transform) {
+    struct t503_mapping const *mapping = &config->mapping;
+    size_t quarter = mapping->rotation / 90;
+    int swapped = quarter % 2;
+    double resolution_x = profile->resolution_x, resolution_y = profile->resolution_y;
+
+    /* An area set for a larger tablet is clipped, one that misses this tablet is dropped */
+    double u0 = 0, v0 = 0, u1 = profile->max_x, v1 = profile->max_y;
+    if (mapping->area[2] && mapping->area[0] < profile->max_x && mapping->area[1] < profile->max_y) {
+        u0 = mapping->area[0];
+        v0 = mapping->area[1];
+        if (mapping->area[2] < u1) u1 = mapping->area[2];
+        if (mapping->area[3] < v1) v1 = mapping->area[3];
+    }
+    double width = u1 - u0, height = v1 - v0;
+
+    /* Crops the area around its center to the aspect of the output, in millimeters as the units are not square */
+    if (mapping->aspect[0]) {
+        double aspect = swapped ? mapping->aspect[1] / mapping->aspect[0] : mapping->aspect[0] / mapping->aspect[1];
+        double width_mm = width / resolution_x, height_mm = height / resolution_y;
+        if (width_mm > height_mm * aspect) {
+            double cropped = height_mm * aspect * resolution_x;
+            u0 += (width - cropped) / 2;
+            width = cropped;
+        } else {
+            double cropped = width_mm / aspect * resolution_y;
+            v0 += (height - cropped) / 2;
+            height = cropped;
+        }
+    }
+
+    /* Position in the area from 0 to 1 as a function of the raw x and y */
+    double position[2][3] = {
+        { 1 / width, 0, -u0 / width },
+        { 0, 1 / height, -v0 / height },
+    };
+    if (profile->mirror_x) {
+        position[0][0] = -1 / width;
+        position[0][2] = (profile->max_x - u0) / width;
+    }
+    double sizes_mm[2] = { width / resolution_x, height / resolution_y };
+    double sizes[2] = { width, height };
+
+    for (size_t i = 0; i < 2; i++) {
+        double const *rotation = s_rotations[quarter][i];
+        size_t axis = i ^ swapped;
+        transform->max[i] = mapping->output[i] ? (int32_t)mapping->output[i] - 1 : (int32_t)lround(sizes[axis]);
+        transform->resolution[i] = (int32_t)lround(transform->max[i] / sizes_mm[axis]);
+        if (transform->resolution[i] < 1) transform->resolution[i] = 1;
+
+        for (size_t j = 0; j < 3; j++) {
+            double coefficient = rotation[0] * position[0][j] + rotation[1] * position[1][j];
+            if (j == 2) coefficient += rotation[2];
+            transform->coefficients[i][j] = llround(coefficient * transform->max[i] * (1 << T503_TRANSFORM_SHIFT));
+        }
+        /* Rounds to the nearest output unit instead of down */
+        transform->coefficients[i][2] += 1 << (T503_TRANSFORM_SHIFT - 1);
+    }
+}
+
+static void t503_pressure_curve_default(struct t503_pressure_curve *curve) {
+    curve->shape = T503_PRESSURE_LINEAR;
+    curve->min = 0;
+    curve->max = T503_PRESSURE_LEVELS - 1;
+}
+
+void t503_config_default(struct t503_config *config) {
+    memset(config, 0, sizeof(*config));
+    t503_mapping_default(&config->mapping);
+    t503_pressure_curve_default(&config->pressure_curve);
+    t503_config_build_pressure(config);
+#define T503_GEN_DEFAULT_KEYMAP(key, bit) \
+    _Static_assert(T503_COUNT_OF(g_mapping_ ## key) <= T503_MAX_KEYS_PER_BUTTON, \
+                   "too many keys for button " #key); \
+    t503_keymap_set(&config->keymap, bit, g_mapping_ ## key, T503_COUNT_OF(g_mapping_ ## key));
+    T503_GEN_DEFAULT_KEYMAP(1, 0)
+    T503_GEN_DEFAULT_KEYMAP(2, 1)
+    T503_GEN_DEFAULT_KEYMAP(3, 2)
+    T503_GEN_DEFAULT_KEYMAP(4, 3)
+    T503_GEN_DEFAULT_KEYMAP(plus, 4)
+    T503_GEN_DEFAULT_KEYMAP(minus, 5)
+#undef T503_GEN_DEFAULT_KEYMAP
+}
+
+static char *t503_trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static int t503_config_parse_keys(struct t503_keymap *keymap, size_t button, char *value,
+                                  const char *path, size_t line_number) {
+    int keys[T503_MAX_KEYS_PER_BUTTON];
+    size_t n_keys = 0;
+    char *saveptr;
+
+    for (char *name = strtok_r(value, " \t", &saveptr); name; name = strtok_r(NULL, " \t", &saveptr)) {
+        if (!strcmp(name, "none")) continue;
+        if (n_keys == T503_MAX_KEYS_PER_BUTTON) {
+            errorf("%s:%zu: more than %d keys\n", path, line_number, T503_MAX_KEYS_PER_BUTTON);
+            return -1;
+        }
+        int code = libevdev_event_code_from_name(EV_KEY, name);
+        if (code < 0) {
+            errorf("%s:%zu: unknown key %s\n", path, line_number, name);
+            return -1;
+        }
+        keys[n_keys++] = code;
+    }
+    t503_keymap_set(keymap, button, keys, n_keys);
+    return 0;
+}
+
+/* Parses up to max_numbers numbers separated by blanks */
+static int t503_config_parse_numbers(char *value, double *numbers, size_t max_numbers, size_t *n_numbers,
+                                     const char *path, size_t line_number) {
+    char *saveptr;
+
+    *n_numbers = 0;
+    for (char *token = strtok_r(value, " \t", &saveptr); token; token = strtok_r(NULL, " \t", &saveptr)) {
+        char *end;
+        if (*n_numbers == max_numbers) {
+            errorf("%s:%zu: too many parameters\n", path, line_number);
+            return -1;
+        }
+        numbers[(*n_numbers)++] = strtod(token, &end);
+        if (*end) {
+            errorf("%s:%zu: %s is not a number\n", path, line_number, token);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int t503_config_parse_exact(char *value, double *numbers, size_t n_expected, const char *name,
+                                   const char *path, size_t line_number) {
+    size_t n_numbers;
+    if (t503_config_parse_numbers(value, numbers, n_expected, &n_numbers, path, line_number)) return -1;
+    if (n_numbers != n_expected) {
+        errorf("%s:%zu: %s takes %zu parameters\n", path, line_number, name, n_expected);
+        return -1;
+    }
+    return 0;
+}
+
+/* area = X0 Y0 X1 Y1, rotation = 0|90|180|270, aspect = WIDTH HEIGHT, output = WIDTH HEIGHT */
+static int t503_config_parse_mapping(struct t503_mapping *mapping, const char *name, char *value,
+                                     const char *path, size_t line_number) {
+    double numbers[4];
+
+    if (!strcmp(name, "area")) {
+        if (t503_config_parse_exact(value, numbers, 4, name, path, line_number)) return -1;
+        if (!(numbers[0] >= 0 && numbers[0] < numbers[2] && numbers[2] <= UINT16_MAX
+              && numbers[1] >= 0 && numbers[1] < numbers[3] && numbers[3] <= UINT16_MAX)) {
+            errorf("%s:%zu: expected X0 < X1 and Y0 < Y1 up to %d\n", path, line_number, UINT16_MAX);
+            return -1;
+        }
+        for (size_t i = 0; i < 4; i++) {
+            mapping->area[i] = (uint16_t)numbers[i];
+        }
+    } else if (!strcmp(name, "rotation")) {
+        if (t503_config_parse_exact(value, numbers, 1, name, path, line_number)) return -1;
+        if (numbers[0] != 0 && numbers[0] != 90 && numbers[0] != 180 && numbers[0] != 270) {
+            errorf("%s:%zu: the rotation must be 0, 90, 180 or 270\n", path, line_number);
+            return -1;
+        }
+        mapping->rotation = (uint16_t)numbers[0];
+    } else if (!strcmp(name, "aspect")) {
+        if (t503_config_parse_exact(value, numbers, 2, name, path, line_number)) return -1;
+        if (!(numbers[0] > 0 && numbers[1] > 0)) {
+            errorf("%s:%zu: the aspect must be positive\n", path, line_number);
+            return -1;
+        }
+        mapping->aspect[0] = numbers[0];
+        mapping->aspect[1] = numbers[1];
+    } else {
+        if (t503_config_parse_exact(value, numbers, 2, name, path, line_number)) return -1;
+        for (size_t i = 0; i < 2; i++) {
+            if (!(numbers[i] >= 2 && numbers[i] <= T503_MAX_OUTPUT)) {
+                errorf("%s:%zu: the output size must be from 2 to %d\n", path, line_number, T503_MAX_OUTPUT);
+                return -1;
+            }
+            mapping->output[i] = (uint32_t)numbers[i];
+        }
+    }
+    return 0;
+}
+
+/* prediction = off|velocity|acceleration, prediction_ms = MS, smoothing = off|MIN_CUTOFF BETA */
+static int t503_config_parse_prediction(struct t503_prediction *prediction, const char *name, char *value,
+                                        const char *path, size_t line_number) {
+    double numbers[2];
+
+    if (!strcmp(name, "prediction")) {
+        for (size_t i = 0; i < T503_COUNT_OF(s_predict_modes); i++) {
+            if (strcmp(value, s_predict_modes[i])) continue;
+            prediction->mode = i;
+            return 0;
+        }
+        errorf("%s:%zu: unknown prediction %s\n", path, line_number, value);
+        return -1;
+    } else if (!strcmp(name, "prediction_ms")) {
+        if (t503_config_parse_exact(value, numbers, 1, name, path, line_number)) return -1;
+        if (!(numbers[0] >= 0 && numbers[0] <= T503_MAX_PREDICTION_MS)) {
+            errorf("%s:%zu: the prediction must be from 0 to %d ms\n", path, line_number, T503_MAX_PREDICTION_MS);
+            return -1;
+        }
+        prediction->lead_ns = (uint64_t)(numbers[0] * 1e6);
+    } else if (!strcmp(value, "off")) {
+        prediction->min_cutoff = 0;
+        prediction->beta = 0;
+    } else {
+        if (t503_config_parse_exact(value, numbers, 2, name, path, line_number)) return -1;
+        if (!(numbers[0] > 0 && numbers[1] >= 0)) {
+            errorf("%s:%zu: the cutoff must be positive and beta not negative\n", path, line_number);
+            return -1;
+        }
+        prediction->min_cutoff = numbers[0];
+        prediction->beta = numbers[1];
+    }
+    return 0;
+}
+
+/* position_deadband = UNITS, pressure_deadband = LEVELS, coalesce = yes|no */
+static int t503_config_parse_filter(struct t503_filter *filter, const char *name, char *value,
+                                    const char *path, size_t line_number) {
+    double numbers[1];
+
+    if (!strcmp(name, "coalesce")) {
+        if (strcmp(value, "yes") && strcmp(value, "no")) {
+            errorf("%s:%zu: expected yes or no\n", path, line_number);
+            return -1;
+        }
+        filter->coalesce = !strcmp(value, "yes");
+        return 0;
+    }
+
+    uint32_t max = !strcmp(name, "pressure_deadband") ? T503_PRESSURE_LEVELS - 1 : T503_MAX_OUTPUT;
+    if (t503_config_parse_exact(value, numbers, 1, name, path, line_number)) return -1;
+    if (!(numbers[0] >= 0 && numbers[0] <= max) || numbers[0] != (uint32_t)numbers[0]) {
+        errorf("%s:%zu: expected a whole number from 0 to %u\n", path, line_number, max);
+        return -1;
+    }
+    if (!strcmp(name, "pressure_deadband")) {
+        filter->pressure_deadband = (uint32_t)numbers[0];
+    } else {
+        filter->position_deadband = (uint32_t)numbers[0];
+    }
+    return 0;
+}
+
+static int t503_config_parse_curve(struct t503_pressure_curve *curve, char *value,
+                                   const char *path, size_t line_number) {
+    double params[4];
+    size_t n_params = 0;
+    char *saveptr;
+
+    char *name = strtok_r(value, " \t", &saveptr);
+    char *rest = strtok_r(NULL, "", &saveptr);
+    if (rest && t503_config_parse_numbers(rest, params, T503_COUNT_OF(params), &n_params, path, line_number)) {
+        return -1;
+    }
+
+    for (size_t i = 0; name && i < T503_COUNT_OF(s_pressure_shapes); i++) {
+        if (strcmp(name, s_pressure_shapes[i].name)) continue;
+        if (n_params != s_pressure_shapes[i].n_params) {
+            errorf("%s:%zu: %s takes %zu parameters\n", path, line_number, name, s_pressure_shapes[i].n_params);
+            return -1;
+        }
+        curve->shape = s_pressure_shapes[i].shape;
+        curve->params[0] = s_pressure_shapes[i].gamma;
+        for (size_t j = 0; j < n_params; j++) {
+            curve->params[j] = params[j];
+        }
+        if (curve->shape == T503_PRESSURE_GAMMA && !(curve->params[0] > 0)) {
+            errorf("%s:%zu: the exponent must be positive\n", path, line_number);
+            return -1;
+        }
+        if (curve->shape == T503_PRESSURE_BEZIER
+            && !(params[0] >= 0 && params[0] <= 1 && params[2] >= 0 && params[2] <= 1)) {
+            errorf("%s:%zu: the x of the control points must be between 0 and 1\n", path, line_number);
+            return -1;
+        }
+        return 0;
+    }
+    errorf("%s:%zu: unknown pressure curve %s\n", path, line_number, name ? name : "");
+    return -1;
+}
+
+static int t503_config_parse_level(uint16_t *level, const char *value, const char *path, size_t line_number) {
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (!*value || *end || parsed >= T503_PRESSURE_LEVELS) {
+        errorf("%s:%zu: expected a pressure level from 0 to %d\n", path, line_number, T503_PRESSURE_LEVELS - 1);
+        return -1;
+    }
+    *level = parsed;
+    return 0;
+}
+
+static int t503_config_parse_line(struct t503_config *config, char *line,
+                                  const char *path, size_t line_number) {
+    char *equal = strchr(line, '=');
+    if (!equal) {
+        errorf("%s:%zu: expected name = value\n", path, line_number);
+        return -1;
+    }
+    *equal = '\0';
+    char *name = t503_trim(line);
+    char *value = t503_trim(equal + 1);
+
+    for (size_t i = 0; i < T503_N_BUTTONS; i++) {
+        if (!strcmp(name, s_button_names[i])) {
+            return t503_config_parse_keys(&config->keymap, i, value, path, line_number);
+        }
+    }
+    if (!strcmp(name, "area") || !strcmp(name, "rotation") || !strcmp(name, "aspect") || !strcmp(name, "output")) {
+        return t503_config_parse_mapping(&config->mapping, name, value, path, line_number);
+    }
+    if (!strcmp(name, "prediction") || !strcmp(name, "prediction_ms") || !strcmp(name, "smoothing")) {
+        return t503_config_parse_prediction(&config->prediction, name, value, path, line_number);
+    }
+    if (!strcmp(name, "position_deadband") || !strcmp(name, "pressure_deadband") || !strcmp(name, "coalesce")) {
+        return t503_config_parse_filter(&config->filter, name, value, path, line_number);
+    }
+    if (!strcmp(name, "pressure_curve")) {
+        return t503_config_parse_curve(&config->pressure_curve, value, path, line_number);
+    }
+    if (!strcmp(name, "pressure_min")) {
+        return t503_config_parse_level(&config->pressure_curve.min, value, path, line_number);
+    }
+    if (!strcmp(name, "pressure_max")) {
+        return t503_config_parse_level(&config->pressure_curve.max, value, path, line_number);
+    }
+    errorf("%s:%zu: unknown setting %s\n", path, line_number, name);
+    return -1;
+}
+
+int t503_config_load(struct t503_config *config, const char *path) {
+    char buf[T503_CONFIG_LINE_SIZE];
+    size_t line_number = 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        errorf("Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    memset(config, 0, sizeof(*config));
+    t503_mapping_default(&config->mapping);
+    config->prediction.lead_ns = T503_DEFAULT_PREDICTION_MS * 1000000ull;
+    t503_pressure_curve_default(&config->pressure_curve);
+    while (fgets(buf, sizeof(buf), file)) {
+        line_number++;
+        char *comment = strchr(buf, '#');
+        if (comment) *comment = '\0';
+        char *line = t503_trim(buf);
+        if (!*line) continue;
+
+        if (t503_config_parse_line(config, line, path, line_number)) {
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+
+    if (config->pressure_curve.min >= config->pressure_curve.max) {
+        errorf("%s: pressure_min must be below pressure_max\n", path);
+        return -1;
+    }
+    /* Built into the spare configuration, a reload swaps in the new table along with the keymap */
+    t503_config_build_pressure(config);
+    return 0;
+}
+
+/* Every key must already be a capability of the uinput device, which cannot change at runtime */
+static int t503_config_check_keys(struct t503_context const *ctx, struct t503_config const *config) {
+    for (size_t i = 0; i < T503_N_BUTTONS; i++) {
+        for (size_t j = 0; j < config->keymap.n_keys[i]; j++) {
+            uint16_t key = config->keymap.keys[i][j];
+            if (!(ctx->key_caps[key / 8] & (1u << (key % 8)))) {
+                errorf("Key %s was not bound at startup, restart to use it\n",
+                    libevdev_event_code_get_name(EV_KEY, key));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* The ranges of the uinput devices are fixed as well */
+static int t503_config_check_output(struct t503_context const *ctx, struct t503_config const *config) {
+    for (size_t d = 0; d < ctx->n_devices; d++) {
+        struct t503_transform const *current = &ctx->devices[d].transform;
+        struct t503_transform transform;
+        t503_config_build_transform(config, ctx->devices[d].profile, &transform);
+        for (size_t i = 0; i < 2; i++) {
+            if (transform.max[i] != current->max[i] || transform.resolution[i] != current->resolution[i]) {
+                errorf("The output range of device %zu changed from %dx%d to %dx%d, restart to use it\n",
+                    d, current->max[0] + 1, current->max[1] + 1, transform.max[0] + 1, transform.max[1] + 1);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void t503_config_reload(struct t503_context *ctx) {
+    struct t503_config *next = ctx->config == &ctx->configs[0] ? &ctx->configs[1] : &ctx->configs[0];
+
+    /* Reading the file allocates, but it is not on the path of a report */
+    int armed = t503_alloc_guard_disarm();
+    int retn = t503_config_load(next, ctx->config_path) || t503_config_check_keys(ctx, next)
+        || t503_config_check_output(ctx, next);
+    if (armed) t503_alloc_guard_arm();
+    if (retn) {
+        errorf("Keeping the previous configuration\n");
+        return;
+    }
+    t503_apply_config(ctx, next);
+    debugf("Reloaded %s\n", ctx->config_path);
+}
+
+static void inotify_cb(void *user_data, uint32_t events) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const char *name = strrchr(ctx->config_path, '/');
+    name = name ? name + 1 : ctx->config_path;
+    int changed = 0;
+    ssize_t length;
+
+    while ((length = read(ctx->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (event->len && !strcmp(event->name, name)) changed = 1;
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    /* Editors often write a file in several steps, reload once per batch */
+    if (changed) t503_config_reload(ctx);
+}
+
+int t503_init_config(struct t503_context *ctx, struct t503_options const *opts) {
+    ctx->config = &ctx->configs[0];
+    ctx->config_path = opts->config_path;
+    ctx->inotify_fd = -1;
+    memset(ctx->key_caps, 0, sizeof(ctx->key_caps));
+
+    if (!opts->config_path) {
+        t503_config_default(ctx->config);
+    } else if (t503_config_load(ctx->config, opts->config_path)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < T503_N_BUTTONS; i++) {
+        for (size_t j = 0; j < ctx->config->keymap.n_keys[i]; j++) {
+            uint16_t key = ctx->config->keymap.keys[i][j];
+            ctx->key_caps[key / 8] |= 1u << (key % 8);
+        }
+    }
+
+    if (!opts->config_path) return 0;
+
+    /* Watch the directory, editors and package managers replace files by renaming */
+    char dir[PATH_MAX];
+    const char *slash = strrchr(opts->config_path, '/');
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == opts->config_path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - opts->config_path), opts->config_path);
+    }
+
+    ctx->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ctx->inotify_fd == -1) goto error;
+    if (inotify_add_watch(ctx->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) goto error;
+    if (t503_reactor_add(&ctx->reactor, ctx->inotify_fd, EPOLLIN, inotify_cb, ctx)) goto error;
+    return 0;
+
+error:
+    errorf("Cannot watch %s for changes: %s\n", opts->config_path, strerror(errno));
+    if (ctx->inotify_fd != -1) close(ctx->inotify_fd);
+    ctx->inotify_fd = -1;
+    return -1;
+}
+
+void t503_exit_config(struct t503_context *ctx) {
+    if (ctx->inotify_fd == -1) return;
+    t503_reactor_remove(&ctx->reactor, ctx->inotify_fd);
+    close(ctx->inotify_fd);
+    ctx->inotify_fd = -1;
+}
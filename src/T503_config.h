@@ -0,0 +1,117 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "T503_decode.h"
+
+#define T503_MAX_KEYS_PER_BUTTON 8
+/* Levels of the pressure table, the raw pressure of every tablet is scaled to them */
+#define T503_PRESSURE_LEVELS 2048
+
+/* Keys sent for each button, indexed by the bit number of T503_BUTTON_BIT_* */
+struct t503_keymap {
+    uint16_t keys[T503_N_BUTTONS][T503_MAX_KEYS_PER_BUTTON];
+    uint8_t n_keys[T503_N_BUTTONS];
+};
+
+enum t503_pressure_shape {
+    T503_PRESSURE_LINEAR,
+    T503_PRESSURE_GAMMA,
+    T503_PRESSURE_BEZIER,
+};
+
+/* Maps raw pressure between min and max, scaled to [0, 1], to the reported pressure in [0, 1] */
+struct t503_pressure_curve {
+    enum t503_pressure_shape shape;
+    /* The exponent of a gamma curve, or x1 y1 x2 y2 of the inner control points of a Bezier curve */
+    double params[4];
+    uint16_t min;
+    uint16_t max;
+};
+
+/* Fractional bits of the coefficients of struct t503_transform */
+#define T503_TRANSFORM_SHIFT 16
+
+/*
+ * Part of the tablet that is mapped to the output, in the coordinates the driver reports by default,
+ * clipped to each tablet.
+ * A zero area is the whole tablet, zero aspect or output values mean the area is not cropped and
+ * keeps the tablet units.
+ */
+struct t503_mapping {
+    uint16_t area[4];
+    uint16_t rotation;
+    double aspect[2];
+    uint32_t output[2];
+};
+
+/* The mapping folded into one affine transform of the raw coordinates, with the ranges it produces */
+struct t503_transform {
+    int64_t coefficients[2][3];
+    int32_t max[2];
+    int32_t resolution[2];
+};
+
+enum t503_predict_mode {
+    T503_PREDICT_OFF,
+    T503_PREDICT_VELOCITY,
+    T503_PREDICT_ACCELERATION,
+};
+
+/* Extrapolation of the pen position by lead_ns, after a 1-euro filter when min_cutoff is not zero */
+struct t503_prediction {
+    enum t503_predict_mode mode;
+    uint64_t lead_ns;
+    /* Cutoff in Hz of a still pen, and how much it grows per unit per second of speed */
+    double min_cutoff;
+    double beta;
+};
+
+/* Pen values within the deadband of the last written ones are not written again */
+struct t503_filter {
+    uint32_t position_deadband;
+    uint32_t pressure_deadband;
+    /* Merge the pen reports of one event loop pass into one frame */
+    int coalesce;
+};
+
+struct t503_config {
+    struct t503_keymap keymap;
+    struct t503_mapping mapping;
+    struct t503_prediction prediction;
+    struct t503_filter filter;
+    struct t503_pressure_curve pressure_curve;
+    /* The curve evaluated for every raw level when the configuration is loaded */
+    uint16_t pressure[T503_PRESSURE_LEVELS];
+};
+
+struct t503_context;
+struct t503_options;
+struct t503_profile;
+
+/* Built-in bindings from T503_key_settings.inc */
+void t503_config_default(struct t503_config *);
+/* Buttons the file does not mention send no keys */
+int t503_config_load(struct t503_config *, const char *path);
+
+/* Folds the mapping of a configuration on one model of tablet into a transform */
+void t503_config_build_transform(struct t503_config const *, struct t503_profile const *, struct t503_transform *);
+
+/* Output coordinates of a raw position, positions outside of the active area stick to its edges */
+static inline void t503_transform_apply(struct t503_transform const *transform, uint16_t x, uint16_t y,
+                                        int32_t out[2]) {
+    for (size_t i = 0; i < 2; i++) {
+        int64_t const *c = transform->coefficients[i];
+        int64_t value = (c[0] * x + c[1] * y + c[2]) >> T503_TRANSFORM_SHIFT;
+        out[i] = value < 0 ? 0 : value > transform->max[i] ? transform->max[i] : (int32_t)value;
+    }
+}
+
+/* Reported pressure of a raw level, out of range levels are clamped to the highest one */
+static inline uint16_t t503_config_pressure(struct t503_config const *config, uint16_t raw) {
+    return config->pressure[raw < T503_PRESSURE_LEVELS ? raw : T503_PRESSURE_LEVELS - 1];
+}
+
+/* Loads the configuration file of the options, if any, and watches it for changes */
+int t503_init_config(struct t503_context *, struct t503_options const *);
+void t503_exit_config(struct t503_context *);
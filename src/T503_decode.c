@@ -0,0 +1,151 @@
+#include "T503_decode.h"
+#include "T503.h"
+
+/* Set in every table entry that is a known code, zero entries are unknown */
+#define T503_CODE_KNOWN 0x80
+/* Keycode echoed in data[3] while minus is held, only valid together with it */
+#define T503_CODE_MINUS_ECHO 0x40
+
+/* Report IDs of the 10moons format */
+#define T503_PAD_REPORT_1 0x02
+#define T503_PAD_REPORT_2 0x03
+#define T503_PEN_REPORT 0x05
+
+static const uint8_t s_report_kinds[256] = {
+    [T503_PAD_REPORT_1] = T503_REPORT_PAD,
+    [T503_PAD_REPORT_2] = T503_REPORT_PAD,
+    [T503_PEN_REPORT] = T503_REPORT_PEN,
+};
+
+/* data[1] of 0x02 reports, a bitfield of three buttons */
+static const uint8_t s_pad_1_bitfield[8] = {
+    0,
+    T503_BUTTON_BIT_MINUS,
+    T503_BUTTON_BIT_1,
+    T503_BUTTON_BIT_MINUS | T503_BUTTON_BIT_1,
+    T503_BUTTON_BIT_2,
+    T503_BUTTON_BIT_MINUS | T503_BUTTON_BIT_2,
+    T503_BUTTON_BIT_1 | T503_BUTTON_BIT_2,
+    T503_BUTTON_BIT_MINUS | T503_BUTTON_BIT_1 | T503_BUTTON_BIT_2,
+};
+
+/* data[3] of 0x02 reports, a keyboard usage per button */
+static const uint8_t s_pad_1_keycode[256] = {
+    [0x00] = T503_CODE_KNOWN,
+    [0x2c] = T503_CODE_KNOWN | T503_BUTTON_BIT_3,
+    [0x2b] = T503_CODE_KNOWN | T503_BUTTON_BIT_4,
+    [0x1d] = T503_CODE_KNOWN | T503_CODE_MINUS_ECHO,
+};
+
+/* data[1] of 0x03 reports */
+static const uint8_t s_pad_2_code[256] = {
+    [0x00] = T503_CODE_KNOWN,
+    [0x02] = T503_CODE_KNOWN | T503_BUTTON_BIT_PLUS,
+};
+
+#define T503_PAD_1_BUTTONS (T503_BUTTON_BIT_MINUS | T503_BUTTON_BIT_1 | T503_BUTTON_BIT_2 \
+                            | T503_BUTTON_BIT_3 | T503_BUTTON_BIT_4)
+#define T503_PAD_2_BUTTONS (T503_BUTTON_BIT_PLUS)
+
+/* 8-byte reports of the T503, pad buttons arrive as keyboard-like reports 0x02 and 0x03 */
+int t503_decode_10moons(const uint8_t *data, int length, struct t503_report *report) {
+    uint8_t code;
+
+    report->buttons = 0;
+    report->buttons_valid = 0;
+    report->pen = 0;
+    report->unknown = 0;
+    report->x = 0;
+    report->y = 0;
+    report->pressure = 0;
+
+    report->kind = length >= T503_IO_BUFFER_SIZE ? s_report_kinds[data[0]] : T503_REPORT_UNKNOWN;
+    switch (report->kind) {
+    case T503_REPORT_PAD:
+        if (data[0] == T503_PAD_REPORT_1) {
+            report->buttons = s_pad_1_bitfield[data[1] & 0x07];
+            report->buttons_valid = T503_PAD_1_BUTTONS;
+            report->unknown = (data[1] & ~0x07) != 0;
+
+            code = s_pad_1_keycode[data[3]];
+            if (!(code & T503_CODE_KNOWN)) {
+                report->unknown = 1;
+            } else if (code & T503_CODE_MINUS_ECHO) {
+                report->unknown |= !(report->buttons & T503_BUTTON_BIT_MINUS);
+            } else {
+                report->buttons |= code & ~T503_CODE_KNOWN;
+            }
+        } else {
+            code = s_pad_2_code[data[1]];
+            report->buttons_valid = T503_PAD_2_BUTTONS;
+            report->buttons = code & ~T503_CODE_KNOWN;
+            report->unknown = !(code & T503_CODE_KNOWN);
+        }
+        break;
+    case T503_REPORT_PEN:
+        if (data[1] & 0x01) report->pen |= T503_PEN_DOWN;
+        if (data[1] & 0xc0) report->pen |= T503_PEN_MOVE;
+        report->unknown = (data[1] & ~0xc1) != 0;
+
+        report->y = t503_load_le16(&data[2]);
+        report->x = t503_load_le16(&data[4]);
+        report->pressure = t503_load_le16(&data[6]);
+        break;
+    default:
+        report->unknown = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * UC-Logic layout of Huion and similar tablets, as the kernel uclogic driver describes it: pen and
+ * frame share report 0x07, frame reports are flagged in data[1] and carry a button bitmap in data[4].
+ */
+#define T503_UCLOGIC_REPORT 0x07
+#define T503_UCLOGIC_LENGTH 8
+#define T503_UCLOGIC_TIP 0x01
+#define T503_UCLOGIC_BARREL 0x06
+#define T503_UCLOGIC_FRAME 0x20
+/* Set while the pen is out of range */
+#define T503_UCLOGIC_OUT_OF_RANGE 0x40
+#define T503_UCLOGIC_VALID 0x80
+
+/* Frame buttons in the order of the bitmap, the first six ones are known */
+#define T503_UCLOGIC_BUTTONS 0x3f
+
+int t503_decode_uclogic(const uint8_t *data, int length, struct t503_report *report) {
+    report->buttons = 0;
+    report->buttons_valid = 0;
+    report->pen = 0;
+    report->unknown = 0;
+    report->x = 0;
+    report->y = 0;
+    report->pressure = 0;
+
+    if (length < T503_UCLOGIC_LENGTH || data[0] != T503_UCLOGIC_REPORT) {
+        report->kind = T503_REPORT_UNKNOWN;
+        report->unknown = 1;
+        return -1;
+    }
+    if (data[1] & T503_UCLOGIC_FRAME) {
+        /* The bitmap has the order of T503_BUTTON_BIT_* */
+        report->kind = T503_REPORT_PAD;
+        report->buttons = data[4] & T503_UCLOGIC_BUTTONS;
+        report->buttons_valid = T503_UCLOGIC_BUTTONS;
+        report->unknown = (data[4] & ~T503_UCLOGIC_BUTTONS) != 0;
+        return 0;
+    }
+
+    /* The barrel buttons have no place in struct t503_report yet, they are left out */
+    report->kind = T503_REPORT_PEN;
+    if (!(data[1] & T503_UCLOGIC_OUT_OF_RANGE)) report->pen |= T503_PEN_MOVE;
+    if (data[1] & T503_UCLOGIC_TIP) report->pen |= T503_PEN_DOWN;
+    report->unknown = (data[1] & ~(T503_UCLOGIC_TIP | T503_UCLOGIC_BARREL | T503_UCLOGIC_OUT_OF_RANGE
+                                   | T503_UCLOGIC_VALID)) != 0;
+
+    report->x = t503_load_le16(&data[2]);
+    report->y = t503_load_le16(&data[4]);
+    report->pressure = t503_load_le16(&data[6]);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define T503_N_BUTTONS 6
+
+/* Bits of t503_report.buttons, in the order the key mappings are applied */
+#define T503_BUTTON_BIT_1       (1u << 0)
+#define T503_BUTTON_BIT_2       (1u << 1)
+#define T503_BUTTON_BIT_3       (1u << 2)
+#define T503_BUTTON_BIT_4       (1u << 3)
+#define T503_BUTTON_BIT_PLUS    (1u << 4)
+#define T503_BUTTON_BIT_MINUS   (1u << 5)
+
+/* Bits of t503_report.pen */
+#define T503_PEN_DOWN   (1u << 0)
+#define T503_PEN_MOVE   (1u << 1)
+
+enum t503_report_kind {
+    T503_REPORT_UNKNOWN,
+    T503_REPORT_PAD,
+    T503_REPORT_PEN,
+};
+
+/* Decoded state of one report, positions and pressure are raw device values */
+struct t503_report {
+    uint8_t kind;
+    /* Pressed buttons, and the buttons whose state this report carries */
+    uint8_t buttons;
+    uint8_t buttons_valid;
+    uint8_t pen;
+    /* Set when the report has bits the decoder does not know */
+    uint8_t unknown;
+    uint16_t x;
+    uint16_t y;
+    uint16_t pressure;
+};
+
+static inline uint16_t t503_load_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+/*
+ * One decoder per report format, see struct t503_profile.
+ * Side-effect free, returns 0 or -1 when the report is not understood.
+ */
+int t503_decode_10moons(const uint8_t *data, int length, struct t503_report *report);
+int t503_decode_uclogic(const uint8_t *data, int length, struct t503_report *report);
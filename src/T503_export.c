@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "T503.h"
+#include "T503_export.h"
+#include "T503_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static void export_accept_cb(void *, uint32_t);
+static void export_client_cb(void *, uint32_t);
+
+
+static void t503_export_disconnect(struct t503_export_client *client) {
+    struct t503_export *export = client->export;
+    t503_reactor_remove(&export->ctx->reactor, client->socket_fd);
+    close(client->socket_fd);
+    close(client->event_fd);
+    munmap(client->flag, sizeof(*client->flag));
+    client->socket_fd = -1;
+    client->event_fd = -1;
+    client->flag = NULL;
+    debugf("Export reader %zu disconnected\n", client->index);
+}
+
+/* Hands the ring, a waiting flag and an eventfd of its own to a new reader */
+static void t503_export_accept(struct t503_export *export, int fd) {
+    struct t503_export_client *client = NULL;
+    struct t503_shm_flag *flag = NULL;
+    int flag_fd = -1;
+    for (size_t i = 0; i < T503_SHM_MAX_READERS && !client; i++) {
+        if (export->clients[i].socket_fd == -1) client = &export->clients[i];
+    }
+    if (!client) {
+        errorf("Refusing export reader, already %d connected\n", T503_SHM_MAX_READERS);
+        close(fd);
+        return;
+    }
+
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) goto error;
+    flag_fd = memfd_create("T503 reader flag", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (flag_fd == -1) goto error;
+    if (ftruncate(flag_fd, sizeof(*flag))) goto error;
+    if (fcntl(flag_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) goto error;
+    void *map = mmap(NULL, sizeof(*flag), PROT_READ | PROT_WRITE, MAP_SHARED, flag_fd, 0);
+    if (map == MAP_FAILED) goto error;
+    flag = (struct t503_shm_flag *)map;
+
+    struct t503_shm_hello hello = { T503_SHM_VERSION, client->index };
+    struct iovec iov = { &hello, sizeof(hello) };
+    int fds[3] = { export->memfd, flag_fd, event_fd };
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = { NULL, 0, &iov, 1, control.buf, sizeof(control.buf), 0 };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)sizeof(hello)) goto error;
+
+    if (t503_reactor_add(&export->ctx->reactor, fd, EPOLLIN, export_client_cb, client)) goto error;
+    close(flag_fd);
+    client->socket_fd = fd;
+    client->event_fd = event_fd;
+    client->flag = flag;
+    debugf("Export reader %zu connected\n", client->index);
+    return;
+
+error:
+    errorf("Cannot set up export reader: %s\n", strerror(errno));
+    if (flag) munmap(flag, sizeof(*flag));
+    if (flag_fd != -1) close(flag_fd);
+    if (event_fd != -1) close(event_fd);
+    close(fd);
+}
+
+static void export_accept_cb(void *user_data, uint32_t events) {
+    struct t503_export *export = (struct t503_export *)user_data;
+    int fd;
+    while ((fd = accept4(export->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        t503_export_accept(export, fd);
+    }
+}
+
+/* Readers send nothing, the socket becomes readable when they close it */
+static void export_client_cb(void *user_data, uint32_t events) {
+    struct t503_export_client *client = (struct t503_export_client *)user_data;
+    char buf[16];
+    ssize_t length;
+
+    while ((length = recv(client->socket_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    }
+    if (length == -1 && (errno == EAGAIN || errno == EINTR)) return;
+    t503_export_disconnect(client);
+}
+
+void t503_export_report(struct t503_export *export, size_t device, struct t503_report const *report,
+                        uint64_t received_ns) {
+    struct t503_shm_sample sample = {
+        0, received_ns, report->x, report->y, report->pressure,
+        report->buttons, report->buttons_valid, report->pen, report->kind, (uint8_t)device, { 0 }
+    };
+    t503_shm_write(export->ring, &sample);
+
+    /* Pairs with the fence of a reader between setting its flag and checking the ring */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < T503_SHM_MAX_READERS; i++) {
+        if (!export->clients[i].flag) continue;
+        if (!__atomic_load_n(&export->clients[i].flag->waiting, __ATOMIC_RELAXED)) continue;
+        uint64_t one = 1;
+        /* Only fails when the counter is full, the reader is awake anyway */
+        if (write(export->clients[i].event_fd, &one, sizeof(one))) {}
+    }
+}
+
+int t503_init_export(struct t503_context *ctx, struct t503_options const *opts) {
+    struct t503_export *export = &ctx->export;
+    struct sockaddr_un addr;
+    struct stat st;
+    int bound = 0;
+
+    export->ctx = ctx;
+    export->path = opts->export_path;
+    export->listen_fd = -1;
+    export->memfd = -1;
+    export->ring = NULL;
+    for (size_t i = 0; i < T503_SHM_MAX_READERS; i++) {
+        export->clients[i].export = export;
+        export->clients[i].index = i;
+        export->clients[i].socket_fd = -1;
+        export->clients[i].event_fd = -1;
+        export->clients[i].flag = NULL;
+    }
+    if (!opts->export_path) return 0;
+
+    if (strlen(opts->export_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        goto error;
+    }
+
+    export->memfd = memfd_create("T503 samples", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (export->memfd == -1) goto error;
+    if (ftruncate(export->memfd, sizeof(struct t503_shm_ring))) goto error;
+    void *map = mmap(NULL, sizeof(struct t503_shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, export->memfd, 0);
+    if (map == MAP_FAILED) goto error;
+    export->ring = (struct t503_shm_ring *)map;
+    t503_shm_init(export->ring);
+    /* Readers cannot resize the ring under the daemon */
+    if (fcntl(export->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW)) goto error;
+#ifdef F_SEAL_FUTURE_WRITE
+    /* Nor map it writable, on Linux 5.1 and later */
+    if (fcntl(export->memfd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) && errno != EINVAL) goto error;
+#endif
+    if (fcntl(export->memfd, F_ADD_SEALS, F_SEAL_SEAL)) goto error;
+
+    /* A socket left behind by a previous run, anything else at the path is kept */
+    if (!lstat(opts->export_path, &st) && S_ISSOCK(st.st_mode)) unlink(opts->export_path);
+
+    export->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (export->listen_fd == -1) goto error;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, opts->export_path);
+    if (bind(export->listen_fd, (struct sockaddr *)&addr, sizeof(addr))) goto error;
+    bound = 1;
+    if (listen(export->listen_fd, T503_SHM_MAX_READERS)) goto error;
+    if (t503_reactor_add(&ctx->reactor, export->listen_fd, EPOLLIN, export_accept_cb, export)) goto error;
+    return 0;
+
+error:
+    errorf("Cannot export samples at %s: %s\n", opts->export_path, strerror(errno));
+    if (bound) unlink(opts->export_path);
+    if (export->listen_fd != -1) close(export->listen_fd);
+    export->listen_fd = -1;
+    if (export->ring) munmap(export->ring, sizeof(struct t503_shm_ring));
+    export->ring = NULL;
+    if (export->memfd != -1) close(export->memfd);
+    export->memfd = -1;
+    return -1;
+}
+
+void t503_exit_export(struct t503_context *ctx) {
+    struct t503_export *export = &ctx->export;
+    if (!export->ring) return;
+
+    for (size_t i = 0; i < T503_SHM_MAX_READERS; i++) {
+        if (export->clients[i].socket_fd != -1) t503_export_disconnect(&export->clients[i]);
+    }
+    t503_reactor_remove(&ctx->reactor, export->listen_fd);
+    close(export->listen_fd);
+    unlink(export->path);
+    export->listen_fd = -1;
+    munmap(export->ring, sizeof(struct t503_shm_ring));
+    export->ring = NULL;
+    close(export->memfd);
+    export->memfd = -1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "T503_decode.h"
+#include "T503_shm.h"
+
+struct t503_context;
+struct t503_options;
+struct t503_export;
+
+/* A connected reader, its socket only tells when it goes away */
+struct t503_export_client {
+    struct t503_export *export;
+    size_t index;
+    int socket_fd;
+    int event_fd;
+    /* Mapped from a memfd of this reader alone, NULL while disconnected */
+    struct t503_shm_flag *flag;
+};
+
+/* Decoded samples published in shared memory, the ring is NULL when nothing is exported */
+struct t503_export {
+    struct t503_context *ctx;
+    const char *path;
+    int listen_fd;
+    int memfd;
+    struct t503_shm_ring *ring;
+    struct t503_export_client clients[T503_SHM_MAX_READERS];
+};
+
+/* Listens on the export socket of the options, if any */
+int t503_init_export(struct t503_context *, struct t503_options const *);
+void t503_exit_export(struct t503_context *);
+
+/* Never waits: the sample goes into the ring and only sleeping readers are woken */
+void t503_export_report(struct t503_export *, size_t device, struct t503_report const *, uint64_t received_ns);
@@ -0,0 +1,267 @@
+#include "T503.h"
+#include "T503_log.h"
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#define T503_SYSFS_HIDRAW "/sys/class/hidraw/"
+#define T503_BUS_USB 0x0003
+
+static int t503_init_hidraw(struct t503_context *, struct t503_options const *);
+static void t503_exit_hidraw(struct t503_context *);
+static int t503_start_hidraw(struct t503_context *);
+static void t503_stop_hidraw(struct t503_context *);
+
+static void hidraw_cb(void *, uint32_t);
+
+const struct t503_source_ops t503_source_hidraw = {
+    "hidraw",
+    t503_init_hidraw,
+    t503_exit_hidraw,
+    t503_start_hidraw,
+    t503_stop_hidraw,
+    NULL,
+};
+
+
+/*
+ * Reads the USB interface number of a hidraw node and its tablet, or -1 if it is not a known tablet.
+ * usb gets the sysfs path of the USB device the interface belongs to.
+ */
+static int t503_hidraw_interface(const char *name, struct t503_profile const **profile, char usb[PATH_MAX]) {
+    char path[PATH_MAX];
+    char line[256];
+    unsigned int bus = 0, vendor = 0, product = 0;
+    int found = 0;
+
+    snprintf(path, sizeof(path), T503_SYSFS_HIDRAW "%s/device/uevent", name);
+    FILE *uevent = fopen(path, "r");
+    if (!uevent) return -1;
+    while (fgets(line, sizeof(line), uevent)) {
+        if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3) {
+            found = 1;
+            break;
+        }
+    }
+    fclose(uevent);
+    if (!found || bus != T503_BUS_USB) return -1;
+    *profile = t503_profile_find((uint16_t)vendor, (uint16_t)product);
+    if (!*profile || (*profile)->init_string) return -1;
+
+    /* .../<bus>-<port>/<bus>-<port>:<config>.<interface>/<bus>:<vid>:<pid>.<n> */
+    snprintf(path, sizeof(path), T503_SYSFS_HIDRAW "%s/device", name);
+    if (!realpath(path, usb)) return -1;
+    char *slash = strrchr(usb, '/');
+    if (!slash) return -1;
+    *slash = '\0';
+    char *dot = strrchr(usb, '.');
+    slash = strrchr(usb, '/');
+    if (!dot || !slash || dot < slash) return -1;
+    int interface = atoi(dot + 1);
+    *slash = '\0';
+    return interface;
+}
+
+/* Fills the missing nodes with the interfaces of one USB device, nothing is filled unless all are found */
+static int t503_hidraw_find_usb(const char *usb, struct t503_profile const *profile,
+                                const char *paths[T503_N_ENDPOINTS], char storage[T503_N_ENDPOINTS][PATH_MAX]) {
+    const char *found_paths[T503_N_ENDPOINTS];
+    char found_usb[PATH_MAX];
+    size_t i;
+
+    memcpy(found_paths, paths, sizeof(found_paths));
+    DIR *dir = opendir(T503_SYSFS_HIDRAW);
+    if (!dir) return -1;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') continue;
+        struct t503_profile const *found;
+        int interface = t503_hidraw_interface(ent->d_name, &found, found_usb);
+        if (interface == -1 || found != profile || strcmp(found_usb, usb)) continue;
+        for (i = 0; i < profile->n_endpoints; i++) {
+            if (interface == profile->interfaces[i] && !found_paths[i]) {
+                snprintf(storage[i], PATH_MAX, "/dev/%s", ent->d_name);
+                found_paths[i] = storage[i];
+            }
+        }
+    }
+    closedir(dir);
+
+    for (i = 0; i < profile->n_endpoints; i++) {
+        if (!found_paths[i]) return -1;
+    }
+    for (i = 0; i < profile->n_endpoints; i++) {
+        if (!paths[i]) debugf("Found interface %d at %s\n", profile->interfaces[i], found_paths[i]);
+        paths[i] = found_paths[i];
+    }
+    return 0;
+}
+
+/* Nodes of the first tablet found, or of the tablet of a node given by path, the profile is its model */
+static int t503_hidraw_find(const char *paths[T503_N_ENDPOINTS], char storage[T503_N_ENDPOINTS][PATH_MAX],
+                            struct t503_profile const **profile) {
+    char usb[PATH_MAX];
+    struct t503_profile const *found;
+
+    /* Interfaces of two tablets of the same model are told apart by their USB device */
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        if (!paths[i]) continue;
+        const char *name = strrchr(paths[i], '/');
+        name = name ? name + 1 : paths[i];
+        if (t503_hidraw_interface(name, &found, usb) == -1 || found != *profile) continue;
+        return t503_hidraw_find_usb(usb, found, paths, storage);
+    }
+
+    DIR *dir = opendir(T503_SYSFS_HIDRAW);
+    if (!dir) return -1;
+
+    int retn = -1;
+    struct dirent *ent;
+    while (retn && (ent = readdir(dir))) {
+        if (ent->d_name[0] == '.') continue;
+        if (t503_hidraw_interface(ent->d_name, &found, usb) == -1 || (*profile && found != *profile)) continue;
+        retn = t503_hidraw_find_usb(usb, found, paths, storage);
+        if (!retn) *profile = found;
+    }
+    closedir(dir);
+    return retn;
+}
+
+/* Keeps the events of the kernel HID driver away from other clients */
+static void t503_hidraw_grab(struct t503_context *ctx, const char *hidraw_path) {
+    const char *name = strrchr(hidraw_path, '/');
+    name = name ? name + 1 : hidraw_path;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), T503_SYSFS_HIDRAW "%s/device/input", name);
+    DIR *inputs = opendir(path);
+    if (!inputs) return;
+
+    struct dirent *input;
+    while ((input = readdir(inputs))) {
+        if (strncmp(input->d_name, "input", 5)) continue;
+
+        char input_path[PATH_MAX];
+        if (snprintf(input_path, sizeof(input_path), "%s/%s", path, input->d_name) >= (int)sizeof(input_path)) {
+            continue;
+        }
+        DIR *events = opendir(input_path);
+        if (!events) continue;
+
+        struct dirent *event;
+        while ((event = readdir(events))) {
+            if (strncmp(event->d_name, "event", 5)) continue;
+            if (ctx->hidraw_n_grabs == T503_MAX_GRABS) break;
+
+            char dev_path[PATH_MAX];
+            snprintf(dev_path, sizeof(dev_path), "/dev/input/%s", event->d_name);
+            int fd = open(dev_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd == -1 || ioctl(fd, EVIOCGRAB, (void *)1)) {
+                errorf("Warning: cannot grab %s, the kernel driver keeps sending events\n", dev_path);
+                if (fd != -1) close(fd);
+                continue;
+            }
+            debugf("Grabbed %s\n", dev_path);
+            ctx->hidraw_grab_fds[ctx->hidraw_n_grabs++] = fd;
+        }
+        closedir(events);
+    }
+    closedir(inputs);
+}
+
+static void hidraw_cb(void *user_data, uint32_t events) {
+    struct t503_hidraw *hidraw = (struct t503_hidraw *)user_data;
+    uint8_t report[T503_IO_BUFFER_SIZE];
+    ssize_t length;
+
+    /* hidraw returns exactly one report per read */
+    while ((length = read(hidraw->fd, report, sizeof(report))) > 0) {
+        t503_handle_report(&hidraw->ctx->devices[0], hidraw->endpoint, report, (int)length, t503_now_ns());
+    }
+    if (length == -1 && (errno == EAGAIN || errno == EINTR)) return;
+
+    errorf("hidraw read error: %s\n", length ? strerror(errno) : "end of file");
+    t503_reactor_remove(&hidraw->ctx->reactor, hidraw->fd);
+    hidraw->ctx->reactor.should_exit = 1;
+}
+
+static int t503_init_hidraw(struct t503_context *ctx, struct t503_options const *opts) {
+    const char *paths[T503_N_ENDPOINTS];
+    char storage[T503_N_ENDPOINTS][PATH_MAX];
+    struct t503_profile const *profile = NULL;
+    size_t i;
+
+    for (i = 0; i < T503_N_ENDPOINTS; i++) {
+        paths[i] = opts->hidraw_paths[i];
+        ctx->hidraw[i].ctx = ctx;
+        ctx->hidraw[i].endpoint = i;
+        ctx->hidraw[i].fd = -1;
+    }
+    ctx->hidraw_n_grabs = 0;
+
+    /* Nodes given by path are taken as the model of the options, the missing ones are looked up */
+    profile = opts->profile;
+    if (paths[0] && !profile) profile = t503_profile_default();
+    int missing = !profile;
+    for (i = 0; profile && i < profile->n_endpoints; i++) {
+        if (!paths[i]) missing = 1;
+    }
+    if (missing && t503_hidraw_find(paths, storage, &profile)) {
+        errorf("hidraw nodes of a known tablet not found\n");
+        return -1;
+    }
+    /* The kernel driver of such a tablet switches it, but rewrites its reports before hidraw gets them */
+    if (profile->init_string) {
+        errorf("The %s can only be read through libusb\n", profile->name);
+        return -1;
+    }
+    if (!t503_add_device(ctx, profile)) return -1;
+
+    for (i = 0; i < profile->n_endpoints; i++) {
+        ctx->hidraw[i].fd = open(paths[i], O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (ctx->hidraw[i].fd == -1) {
+            errorf("Cannot open %s: %s\n", paths[i], strerror(errno));
+            goto error;
+        }
+        if (t503_reactor_add(&ctx->reactor, ctx->hidraw[i].fd, EPOLLIN, hidraw_cb, &ctx->hidraw[i])) {
+            goto error;
+        }
+        t503_hidraw_grab(ctx, paths[i]);
+    }
+    return 0;
+
+error:
+    t503_exit_hidraw(ctx);
+    return -1;
+}
+
+static void t503_exit_hidraw(struct t503_context *ctx) {
+    for (size_t i = 0; i < ctx->hidraw_n_grabs; i++) {
+        ioctl(ctx->hidraw_grab_fds[i], EVIOCGRAB, (void *)0);
+        close(ctx->hidraw_grab_fds[i]);
+    }
+    ctx->hidraw_n_grabs = 0;
+
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        if (ctx->hidraw[i].fd == -1) continue;
+        t503_reactor_remove(&ctx->reactor, ctx->hidraw[i].fd);
+        close(ctx->hidraw[i].fd);
+        ctx->hidraw[i].fd = -1;
+    }
+}
+
+/* Reads are driven by the reactor as soon as the nodes are open */
+static int t503_start_hidraw(struct t503_context *ctx) {
+    return 0;
+}
+
+static void t503_stop_hidraw(struct t503_context *ctx) {
+}
@@ -0,0 +1,924 @@
+#include "T503.h"
+#include "T503_alloc_guard.h"
+#include "T503_log.h"
+#include <assert.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define T503_LANGID_EN_US 0x0409
+/* Longer than the parameters of any UC-Logic tablet */
+#define T503_INIT_STRING_LENGTH 32
+
+static int t503_init_libusb(struct t503_context *, struct t503_options const *);
+static void t503_exit_libusb(struct t503_context *);
+static int t503_start_libusb(struct t503_context *);
+static void t503_stop_libusb(struct t503_context *);
+static int t503_libusb_timeout_ms(struct t503_context *);
+static void t503_libusb_close(struct t503_device *);
+static void t503_libusb_teardown(struct t503_device *);
+
+static void libusb_pollfd_cb(void *, uint32_t);
+static void transfer_cb(struct libusb_transfer *);
+static int hotplug_cb(libusb_context *, libusb_device *, libusb_hotplug_event, void *);
+static void hotplug_work_cb(void *, uint32_t);
+
+const struct t503_source_ops t503_source_libusb = {
+    "libusb",
+    t503_init_libusb,
+    t503_exit_libusb,
+    t503_start_libusb,
+    t503_stop_libusb,
+    t503_libusb_timeout_ms,
+};
+
+
+#if defined(_MSC_VER)
+#pragma pack(push, 1)
+#endif
+
+
+struct HID_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdHID;
+    uint8_t bCountryCode;
+    uint8_t bNumDescriptors;
+    uint8_t bDescriptorType2;
+    uint16_t wDescriptorLength;
+}
+#if defined(__GNUC__)
+__attribute__ ((packed))
+#endif
+;
+
+#if defined(_MSC_VER)
+#pragma pack(pop)
+#endif
+
+
+
+static void t503_exit_libusb(struct t503_context *ctx) {
+    if (ctx->libusb_hotplug_registered) {
+        libusb_hotplug_deregister_callback(ctx->libusb_ctx, ctx->libusb_hotplug);
+    }
+    for (size_t i = 0; i < ctx->libusb_n_arrived; i++) libusb_unref_device(ctx->libusb_arrived[i]);
+    ctx->libusb_n_arrived = 0;
+    t503_reactor_remove_timer(&ctx->reactor, ctx->libusb_work_timer_fd);
+
+    libusb_set_pollfd_notifiers(ctx->libusb_ctx, NULL, NULL, NULL);
+    const struct libusb_pollfd **pollfds = libusb_get_pollfds(ctx->libusb_ctx);
+    if (pollfds) {
+        for (size_t i = 0; pollfds[i]; i++) {
+            t503_reactor_remove(&ctx->reactor, pollfds[i]->fd);
+        }
+        libusb_free_pollfds(pollfds);
+    }
+
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        if (ctx->devices[i].libusb_handle) t503_libusb_close(&ctx->devices[i]);
+        t503_libusb_teardown(&ctx->devices[i]);
+    }
+    assert(ctx->libusb_ctx);
+    libusb_exit(ctx->libusb_ctx);
+}
+
+static uint32_t t503_poll_to_epoll(short events) {
+    uint32_t retn = 0;
+    if (events & POLLIN) retn |= EPOLLIN;
+    if (events & POLLOUT) retn |= EPOLLOUT;
+    return retn;
+}
+
+static void libusb_pollfd_cb(void *user_data, uint32_t events) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(ctx->libusb_ctx, &zero, NULL);
+}
+
+/* A fd that is not watched would never complete its transfers, the caller that made libusb add it fails instead */
+static void libusb_pollfd_added(int fd, short events, void *user_data) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    if (t503_reactor_add(&ctx->reactor, fd, t503_poll_to_epoll(events), libusb_pollfd_cb, ctx)) {
+        ctx->libusb_poll_failed = 1;
+    }
+}
+
+static void libusb_pollfd_removed(int fd, void *user_data) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    t503_reactor_remove(&ctx->reactor, fd);
+}
+
+/* Timeout for the next reactor wait, only needed when libusb has no timerfd of its own */
+static int t503_libusb_timeout_ms(struct t503_context *ctx) {
+    struct timeval tv;
+    if (libusb_pollfds_handle_timeouts(ctx->libusb_ctx)) return -1;
+    if (libusb_get_next_timeout(ctx->libusb_ctx, &tv) != 1) return -1;
+    return tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+}
+
+
+static void display_device_descriptor(struct libusb_device_descriptor const *desc) {
+    debugf("Device Descriptor:\n");
+
+    debugf("bLength: %d\n", desc->bLength);
+    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
+    debugf("bcdUSB: %x\n", desc->bcdUSB);
+    debugf("bDeviceClass: %d\n", desc->bDeviceClass);
+    debugf("bDeviceSubClass: %d\n", desc->bDeviceSubClass);
+
+    debugf("bDeviceProtocol: %d\n", desc->bDeviceProtocol);
+    debugf("bMaxPacketSize0: %d\n", desc->bMaxPacketSize0);
+    debugf("idVendor: %x\n", desc->idVendor);
+    debugf("idProduct: %x\n", desc->idProduct);
+    debugf("bcdDevice: %x\n", desc->bcdDevice);
+
+    debugf("iManufacturer: %x\n", desc->iManufacturer);
+    debugf("iProduct: %x\n", desc->iProduct);
+    debugf("iSerialNumber: %x\n", desc->iSerialNumber);
+    debugf("bNumConfigurations: %x\n\n", desc->bNumConfigurations);
+}
+
+static void display_config_descriptor(struct libusb_config_descriptor const *desc) {
+    debugf("Configuration Descriptor:\n");
+
+    debugf("bLength: %d\n", desc->bLength);
+    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
+    debugf("wTotalLength: %d\n", desc->wTotalLength);
+    debugf("bNumInterfaces: %d\n", desc->bNumInterfaces);
+    debugf("bConfigurationValue: %d\n", desc->bConfigurationValue);
+
+    debugf("iConfiguration: %d\n", desc->iConfiguration);
+    debugf("bmAttributes: %d\n", desc->bmAttributes);
+    debugf("MaxPower: %d\n", desc->MaxPower);
+
+    debugf("extra_length: %d\n\n", desc->extra_length);
+}
+
+static void display_interface_descriptor(struct libusb_interface_descriptor const *conf) {
+    debugf("Interface Descriptor:\n");
+
+    debugf("bLength: %d\n", conf->bLength);
+    debugf("bDescriptorType: %d\n", conf->bDescriptorType);
+    debugf("bInterfaceNumber: %d\n", conf->bInterfaceNumber);
+    debugf("bAlternateSetting: %d\n", conf->bAlternateSetting);
+    debugf("bNumEndpoints: %d\n", conf->bNumEndpoints);
+
+    debugf("bInterfaceClass: %d\n", conf->bInterfaceClass);
+    debugf("bInterfaceSubClass: %d\n", conf->bInterfaceSubClass);
+    debugf("bInterfaceProtocol: %d\n", conf->bInterfaceProtocol);
+    debugf("iInterface: %d\n", conf->iInterface);
+
+    debugf("extra_length: %d\n\n", conf->extra_length);
+}
+
+static void display_endpoint_descriptor(struct libusb_endpoint_descriptor const *desc) {
+    debugf("Endpoint Descriptor:\n");
+
+    debugf("bLength: %d\n", desc->bLength);
+    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
+    debugf("bEndpointAddress: %d\n", desc->bEndpointAddress);
+    debugf("bEndpointAddress: endpoint number %d\n",
+        desc->bEndpointAddress & LIBUSB_ENDPOINT_ADDRESS_MASK);
+    debugf("bEndpointAddress: Is direction IN? %d\n",
+        (desc->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN);
+    debugf("bmAttributes: %d\n", desc->bmAttributes);
+    debugf("bmAttributes: endpoint transfer type %d\n",
+        desc->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK);
+    debugf("bmAttributes: synchronization type %d\n",
+        (desc->bmAttributes & LIBUSB_ISO_SYNC_TYPE_MASK) >> 2);
+    debugf("bmAttributes: usage type %d\n",
+        (desc->bmAttributes & LIBUSB_ISO_USAGE_TYPE_MASK) >> 4);
+    debugf("wMaxPacketSize: %d\n", desc->wMaxPacketSize);
+
+    debugf("bInterval: %d\n", desc->bInterval);
+    debugf("bRefresh: %d\n", desc->bRefresh);
+    debugf("bSynchAddress: %d\n", desc->bSynchAddress);
+
+    debugf("extra_length: %d\n\n", desc->extra_length);
+}
+
+static void display_HID_descriptor(struct HID_descriptor const *desc) {
+    debugf("HID Descriptor:\n");
+
+    debugf("bLength: %d\n", desc->bLength);
+    debugf("bDescriptorType: %d\n", desc->bDescriptorType);
+    debugf("bcdHID: %d\n", desc->bcdHID);
+    debugf("bCountryCode: %d\n", desc->bCountryCode);
+    debugf("bNumDescriptors: %d\n", desc->bNumDescriptors);
+
+    debugf("bDescriptorType2: %d\n", desc->bDescriptorType2);
+    debugf("wDescriptorLength: %d\n\n", desc->wDescriptorLength);
+
+}
+
+static void display_transfer(struct libusb_transfer *transfer) {
+    if (transfer == NULL) {
+        debugf("No transfer... Why?\n");
+    } else {
+        debugf("struct libusb_transfer:\n");
+        debugf("flags: %x \n", transfer->flags);
+        debugf("endpoint: %x \n", transfer->endpoint);
+        debugf("type: %x \n", transfer->type);
+        debugf("timeout: %d \n", transfer->timeout);
+        debugf("status: %d \n", transfer->status);
+
+        debugf("length: %d \n", transfer->length);
+        debugf("actual_length: %d \n", transfer->actual_length);
+        debugf("buffer: %p \n", transfer->buffer);
+
+        for (int i = 0; i < transfer->actual_length; i++){
+            debugf("%02x", transfer->buffer[i]);
+        }
+        debugf("\n");
+    }
+    return;
+}
+
+static size_t t503_endpoint_index(struct t503_device const *device, uint8_t address) {
+    for (size_t i = 0; i < device->profile->n_endpoints; i++) {
+        if (device->libusb_endpoint_addresses[i] == address) return i;
+    }
+    assert(0);
+    return 0;
+}
+
+static size_t t503_libusb_inflight(struct t503_context const *ctx) {
+    size_t n_inflight = 0;
+    for (size_t i = 0; i < ctx->n_devices; i++) n_inflight += ctx->devices[i].libusb_inflight;
+    return n_inflight;
+}
+
+static const char *const s_transfer_error_names[T503_TRANSFER_N_ERRORS] = {
+    [T503_TRANSFER_ERROR] = "transfer error",
+    [T503_TRANSFER_TIMED_OUT] = "transfer timed out",
+    [T503_TRANSFER_STALL] = "endpoint stalled",
+    [T503_TRANSFER_OVERFLOW] = "transfer overflow",
+    [T503_TRANSFER_NO_DEVICE] = "no device",
+    [T503_TRANSFER_SUBMIT] = "cannot resubmit",
+};
+
+static enum t503_transfer_error t503_classify_transfer(enum libusb_transfer_status status) {
+    switch (status) {
+    case LIBUSB_TRANSFER_TIMED_OUT: return T503_TRANSFER_TIMED_OUT;
+    case LIBUSB_TRANSFER_STALL: return T503_TRANSFER_STALL;
+    case LIBUSB_TRANSFER_OVERFLOW: return T503_TRANSFER_OVERFLOW;
+    case LIBUSB_TRANSFER_NO_DEVICE: return T503_TRANSFER_NO_DEVICE;
+    default: return T503_TRANSFER_ERROR;
+    }
+}
+
+static void t503_libusb_device_lost(struct t503_device *device) {
+    /* With hotplug the departure event follows and the tablet is waited for */
+    if (device->ctx->libusb_hotplug_registered) return;
+    errorf("T503 %zu disconnected\n", device->index);
+    device->ctx->reactor.should_exit = 1;
+}
+
+/* Arms the recovery timer with the current backoff and doubles it for the next attempt */
+static void t503_libusb_schedule_recovery(struct t503_libusb_recovery *recovery) {
+    t503_reactor_arm_timer(recovery->timer_fd, recovery->backoff_ns, 0);
+    recovery->backoff_ns *= 2;
+    if (recovery->backoff_ns > T503_RECOVERY_MAX_NS) recovery->backoff_ns = T503_RECOVERY_MAX_NS;
+}
+
+/* Keeps a transfer that is no longer in flight until the recovery timer of its endpoint resubmits it */
+static void t503_libusb_park(struct t503_device *device, struct libusb_transfer *transfer, enum t503_transfer_error error) {
+    struct t503_libusb_recovery *recovery = &device->libusb_recovery[t503_endpoint_index(device, transfer->endpoint)];
+
+    t503_counter_inc(&device->stats.transfer_errors[error]);
+    if (error == T503_TRANSFER_NO_DEVICE) {
+        t503_libusb_device_lost(device);
+        return;
+    }
+    if (error == T503_TRANSFER_STALL) recovery->halted = 1;
+
+    recovery->parked[recovery->n_parked++] = transfer;
+    /* Later failures join the attempt scheduled by the first one */
+    if (recovery->n_parked == 1) {
+        errorf("T503 %zu endpoint %zu: %s, resubmitting in %llu ms\n", device->index, recovery->endpoint,
+            s_transfer_error_names[error], (unsigned long long)(recovery->backoff_ns / 1000000));
+        t503_libusb_schedule_recovery(recovery);
+    }
+}
+
+static void recovery_cb(void *user_data, uint32_t events) {
+    struct t503_libusb_recovery *recovery = (struct t503_libusb_recovery *)user_data;
+    struct t503_device *device = recovery->device;
+    size_t n_parked = 0;
+    int retn;
+
+    if (device->ctx->libusb_stopping || device->libusb_detaching || !device->libusb_handle) return;
+
+    if (recovery->halted) {
+        retn = libusb_clear_halt(device->libusb_handle, device->libusb_endpoint_addresses[recovery->endpoint]);
+        if (retn == LIBUSB_ERROR_NO_DEVICE) {
+            t503_libusb_device_lost(device);
+            return;
+        }
+        if (retn == 0) recovery->halted = 0;
+        else debugf("T503 %zu endpoint %zu: cannot clear halt: %s\n", device->index, recovery->endpoint, libusb_error_name(retn));
+    }
+
+    for (size_t i = 0; i < recovery->n_parked; i++) {
+        retn = recovery->halted ? LIBUSB_ERROR_PIPE : libusb_submit_transfer(recovery->parked[i]);
+        if (retn == 0) {
+            device->libusb_inflight++;
+            continue;
+        }
+        if (retn == LIBUSB_ERROR_NO_DEVICE) {
+            t503_libusb_device_lost(device);
+            return;
+        }
+        recovery->parked[n_parked++] = recovery->parked[i];
+    }
+    recovery->n_parked = n_parked;
+
+    if (n_parked) {
+        debugf("T503 %zu endpoint %zu: %zu transfers still failing, retrying in %llu ms\n",
+            device->index, recovery->endpoint, n_parked, (unsigned long long)(recovery->backoff_ns / 1000000));
+        t503_libusb_schedule_recovery(recovery);
+        return;
+    }
+    t503_counter_inc(&device->stats.recoveries);
+    infof("T503 %zu endpoint %zu: recovered\n", device->index, recovery->endpoint);
+}
+
+static void transfer_cb(struct libusb_transfer *transfer) {
+    uint64_t received_ns = t503_now_ns();
+    struct t503_device *device = (struct t503_device *)transfer->user_data;
+    struct t503_context *ctx = device->ctx;
+    uint8_t report[T503_IO_BUFFER_SIZE];
+    size_t endpoint;
+    int length;
+    int retn;
+
+    if (t503_log_enabled(T503_LOG_DEBUG)) display_transfer(transfer);
+
+    device->libusb_inflight--;
+    /* Nothing is resubmitted once the source is stopping, so that all transfers can be reaped */
+    if (ctx->libusb_stopping) return;
+    if (device->libusb_detaching) {
+        if (!device->libusb_inflight) t503_reactor_arm_timer(ctx->libusb_work_timer_fd, 1, 0);
+        return;
+    }
+
+    switch (transfer->status) {
+    case LIBUSB_TRANSFER_CANCELLED:
+        break;
+    case LIBUSB_TRANSFER_COMPLETED:
+        /* Requeue before decoding so the endpoint never runs dry */
+        endpoint = t503_endpoint_index(device, transfer->endpoint);
+        length = transfer->actual_length;
+        memcpy(report, transfer->buffer, length);
+        retn = libusb_submit_transfer(transfer);
+        if (retn == 0) {
+            device->libusb_inflight++;
+            device->libusb_recovery[endpoint].backoff_ns = T503_RECOVERY_MIN_NS;
+        } else {
+            t503_libusb_park(device, transfer, retn == LIBUSB_ERROR_NO_DEVICE ? T503_TRANSFER_NO_DEVICE : T503_TRANSFER_SUBMIT);
+        }
+
+        t503_handle_report(device, endpoint, report, length, received_ns);
+        break;
+    default:
+        t503_libusb_park(device, transfer, t503_classify_transfer(transfer->status));
+    }
+}
+
+static void t503_libusb_display(libusb_device_handle *handle, struct libusb_config_descriptor const *config) {
+    struct libusb_device_descriptor desc;
+    libusb_get_device_descriptor(libusb_get_device(handle), &desc);
+    display_device_descriptor(&desc);
+
+    display_config_descriptor(config);
+
+    for (size_t i = 0; i < config->bNumInterfaces; i++) {
+        display_interface_descriptor(config->interface[i].altsetting);
+    }
+    for (size_t i = 0; i < config->bNumInterfaces; i++) {
+        for (size_t j = 0; j < config->interface[i].altsetting->bNumEndpoints; j++) {
+            display_endpoint_descriptor(&config->interface[i].altsetting->endpoint[j]);
+        }
+    }
+    for (size_t i = 0; i < config->bNumInterfaces; i++) {
+        if (!config->interface[i].altsetting->extra_length) continue;
+        display_HID_descriptor((const struct HID_descriptor *)
+            config->interface[i].altsetting->extra);
+    }
+
+    unsigned char buf[1024] = {};
+    libusb_get_string_descriptor_ascii(handle, 0, buf, sizeof(buf));
+    debugf("string 0: %s\n", buf);
+    libusb_get_string_descriptor_ascii(handle, 1, buf, sizeof(buf));
+    debugf("string 1: %s\n", buf);
+    libusb_get_string_descriptor_ascii(handle, 2, buf, sizeof(buf));
+    debugf("string 2: %s\n", buf);
+    libusb_get_string_descriptor_ascii(handle, 3, buf, sizeof(buf));
+    debugf("string 3: %s\n", buf);
+}
+
+static void t503_libusb_submit_all(struct t503_device *device) {
+    for (size_t i = 0; i < device->profile->n_endpoints; i++) {
+        for (size_t j = 0; j < device->ctx->libusb_n_transfers; j++) {
+            int retn = libusb_submit_transfer(device->libusb_transfers[i][j]);
+            if (retn == 0) {
+                device->libusb_inflight++;
+            } else {
+                t503_libusb_park(device, device->libusb_transfers[i][j],
+                    retn == LIBUSB_ERROR_NO_DEVICE ? T503_TRANSFER_NO_DEVICE : T503_TRANSFER_SUBMIT);
+            }
+        }
+    }
+}
+
+/* Transfers and recovery timers of a device are created on its first attach and kept until exit */
+static int t503_libusb_setup(struct t503_device *device) {
+    if (device->libusb_transfers[0][0]) return 0;
+
+    /* Only the transfers in use, the rest of the pool stays NULL */
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        for (size_t j = 0; j < device->ctx->libusb_n_transfers; j++) {
+            device->libusb_transfers[i][j] = libusb_alloc_transfer(0);
+            if (!device->libusb_transfers[i][j]) goto error;
+        }
+    }
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        struct t503_libusb_recovery *recovery = &device->libusb_recovery[i];
+        recovery->device = device;
+        recovery->endpoint = i;
+        recovery->timer_fd = t503_reactor_add_timer(&device->ctx->reactor, 0, recovery_cb, recovery);
+        if (recovery->timer_fd == -1) goto error;
+    }
+    return 0;
+
+error:
+    t503_libusb_teardown(device);
+    return -1;
+}
+
+static void t503_libusb_teardown(struct t503_device *device) {
+    struct libusb_transfer **transfers = &device->libusb_transfers[0][0];
+    for (size_t i = 0; i < T503_N_ENDPOINTS * T503_MAX_TRANSFERS; i++) {
+        if (transfers[i]) libusb_free_transfer(transfers[i]);
+        transfers[i] = NULL;
+    }
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        struct t503_libusb_recovery *recovery = &device->libusb_recovery[i];
+        if (recovery->timer_fd != -1) t503_reactor_remove_timer(&device->ctx->reactor, recovery->timer_fd);
+        recovery->timer_fd = -1;
+    }
+}
+
+/*
+ * Endpoint addresses of the model of a tablet. Only the first tablet of each model costs reading the
+ * configuration descriptor, and dumping it, later ones and reattaches take the cached addresses.
+ */
+static int t503_libusb_endpoints(struct t503_context *ctx, libusb_device *dev, libusb_device_handle *handle,
+                                 struct t503_profile const *profile, struct t503_libusb_endpoints **endpoints) {
+    for (size_t i = 0; i < ctx->libusb_n_endpoints; i++) {
+        *endpoints = &ctx->libusb_endpoints[i];
+        if ((*endpoints)->profile == profile) return 0;
+    }
+    /* A model per device at most */
+    assert(ctx->libusb_n_endpoints < T503_MAX_DEVICES);
+
+    struct libusb_config_descriptor *config;
+    int retn = libusb_get_config_descriptor(dev, 0, &config);
+    if (retn < 0) return retn;
+    *endpoints = &ctx->libusb_endpoints[ctx->libusb_n_endpoints++];
+    (*endpoints)->profile = profile;
+    for (size_t i = 0; i < profile->n_endpoints; i++) {
+        (*endpoints)->addresses[i] = config->interface[profile->interfaces[i]].altsetting->endpoint[0].bEndpointAddress;
+    }
+    /* Dumping them takes a few control transfers */
+    if (t503_log_enabled(T503_LOG_DEBUG)) t503_libusb_display(handle, config);
+    libusb_free_config_descriptor(config);
+    return 0;
+}
+
+/* Reading the init string of a UC-Logic tablet switches it to its own reports, the string holds its parameters */
+static int t503_libusb_init_string(libusb_device_handle *handle, struct t503_profile const *profile) {
+    uint8_t buf[T503_INIT_STRING_LENGTH];
+    int length = libusb_get_string_descriptor(handle, profile->init_string, T503_LANGID_EN_US, buf, sizeof(buf));
+    if (length < 0) return length;
+    if (length >= 12) {
+        debugf("%s parameters: max x %u, max y %u, max pressure %u, resolution %u\n", profile->name,
+            t503_load_le16(&buf[2]), t503_load_le16(&buf[4]), t503_load_le16(&buf[8]), t503_load_le16(&buf[10]));
+    }
+    return 0;
+}
+
+/* Bus number followed by the port numbers, the same for a tablet plugged back into the same port */
+static int t503_libusb_port_path(libusb_device *dev, uint8_t path[T503_MAX_PORT_PATH]) {
+    path[0] = libusb_get_bus_number(dev);
+    int retn = libusb_get_port_numbers(dev, path + 1, T503_MAX_PORT_PATH - 1);
+    return retn < 0 ? 1 : retn + 1;
+}
+
+/* Opens a tablet for a device, its transfers are submitted right away once the source started */
+static int t503_libusb_attach(struct t503_device *device, libusb_device *dev) {
+    struct t503_context *ctx = device->ctx;
+    struct t503_profile const *profile = device->profile;
+    libusb_device_handle *handle;
+    size_t n_claimed;
+
+    int retn = t503_libusb_setup(device);
+    if (retn) {
+        retn = LIBUSB_ERROR_NO_MEM;
+        goto error_t503_libusb_setup;
+    }
+
+    ctx->libusb_poll_failed = 0;
+    retn = libusb_open(dev, &handle);
+    if (retn) goto error_libusb_open;
+    if (ctx->libusb_poll_failed) {
+        retn = LIBUSB_ERROR_NO_MEM;
+        goto error_libusb_poll;
+    }
+
+    retn = libusb_set_auto_detach_kernel_driver(handle, 1);
+    if (retn) goto error_libusb_set_auto_detach_kernel_driver;
+
+    for (n_claimed = 0; n_claimed < profile->n_endpoints; n_claimed++) {
+        retn = libusb_claim_interface(handle, profile->interfaces[n_claimed]);
+        if (retn) goto error_libusb_claim_interface;
+    }
+
+    if (profile->init_string) {
+        retn = t503_libusb_init_string(handle, profile);
+        if (retn) goto error_t503_libusb_init_string;
+    }
+
+    struct t503_libusb_endpoints *endpoints;
+    retn = t503_libusb_endpoints(ctx, dev, handle, profile, &endpoints);
+    if (retn) goto error_t503_libusb_endpoints;
+    memcpy(device->libusb_endpoint_addresses, endpoints->addresses, sizeof(endpoints->addresses));
+
+    device->libusb_handle = handle;
+    device->libusb_device = libusb_ref_device(dev);
+    device->port_path_length = t503_libusb_port_path(dev, device->port_path);
+
+    for (size_t i = 0; i < profile->n_endpoints; i++) {
+        for (size_t j = 0; j < ctx->libusb_n_transfers; j++) {
+            libusb_fill_interrupt_transfer(
+                device->libusb_transfers[i][j], handle, device->libusb_endpoint_addresses[i],
+                device->arena.transfer_buffers[i][j], T503_IO_BUFFER_SIZE, transfer_cb, (void *)device, 0
+            );
+        }
+    }
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        device->libusb_recovery[i].halted = 0;
+        device->libusb_recovery[i].backoff_ns = T503_RECOVERY_MIN_NS;
+        device->libusb_recovery[i].n_parked = 0;
+    }
+
+    if (ctx->libusb_started) t503_libusb_submit_all(device);
+    return 0;
+
+/* Warning: the label below should be in reversed order compared to the corresponding above */
+
+error_t503_libusb_endpoints:
+error_t503_libusb_init_string:
+error_libusb_claim_interface:
+    while (n_claimed--) libusb_release_interface(handle, profile->interfaces[n_claimed]);
+error_libusb_set_auto_detach_kernel_driver:
+error_libusb_poll:
+    libusb_close(handle);
+error_libusb_open:
+error_t503_libusb_setup:
+    errorf("Cannot open the %s: %s\n", profile->name, libusb_strerror(retn));
+    return -1;
+}
+
+/* Gives the tablet of a device back, its transfers must have been reaped */
+static void t503_libusb_close(struct t503_device *device) {
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        struct t503_libusb_recovery *recovery = &device->libusb_recovery[i];
+        recovery->n_parked = 0;
+        if (recovery->timer_fd != -1) t503_reactor_arm_timer(recovery->timer_fd, 0, 0);
+    }
+
+    for (size_t i = device->profile->n_endpoints; i-- > 0;) {
+        libusb_release_interface(device->libusb_handle, device->profile->interfaces[i]);
+    }
+    libusb_close(device->libusb_handle);
+    device->libusb_handle = NULL;
+    libusb_unref_device(device->libusb_device);
+    device->libusb_device = NULL;
+}
+
+/* "1-2.3", or a sysfs directory named like it, into the bus number followed by the port numbers */
+static int t503_libusb_parse_path(const char *text, uint8_t path[T503_MAX_PORT_PATH]) {
+    const char *name = strrchr(text, '/');
+    name = name ? name + 1 : text;
+
+    int length = 0;
+    char *end;
+    unsigned long value = strtoul(name, &end, 10);
+    if (end == name || *end != '-' || value > UINT8_MAX) return -1;
+    path[length++] = value;
+    do {
+        name = end + 1;
+        value = strtoul(name, &end, 10);
+        if (end == name || value > UINT8_MAX || length == T503_MAX_PORT_PATH) return -1;
+        path[length++] = value;
+    } while (*end == '.');
+    return *end ? -1 : length;
+}
+
+static int t503_libusb_wanted(struct t503_context const *ctx, libusb_device *dev) {
+    if (!ctx->libusb_n_paths) return 1;
+
+    uint8_t path[T503_MAX_PORT_PATH];
+    int length = t503_libusb_port_path(dev, path);
+    for (size_t i = 0; i < ctx->libusb_n_paths; i++) {
+        if (ctx->libusb_path_lengths[i] == length && !memcmp(ctx->libusb_paths[i], path, length)) return 1;
+    }
+    return 0;
+}
+
+/* Model of a tablet, NULL if it is not one */
+static struct t503_profile const *t503_libusb_profile(libusb_device *dev) {
+    struct libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(dev, &desc)) return NULL;
+    return t503_profile_find(desc.idVendor, desc.idProduct);
+}
+
+/*
+ * The device a tablet of the same model in the same port had, else a new one, else any device of
+ * that model without a tablet. The ranges of an input device stay those of the model it was made for.
+ */
+static struct t503_device *t503_libusb_pick_device(struct t503_context *ctx, libusb_device *dev,
+                                                   struct t503_profile const *profile) {
+    uint8_t path[T503_MAX_PORT_PATH];
+    int length = t503_libusb_port_path(dev, path);
+    struct t503_device *idle = NULL;
+
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        struct t503_device *device = &ctx->devices[i];
+        if (device->libusb_handle || device->profile != profile) continue;
+        if (device->port_path_length == length && !memcmp(device->port_path, path, length)) return device;
+        if (!idle) idle = device;
+    }
+    struct t503_device *device = t503_add_device(ctx, profile);
+    return device ? device : idle;
+}
+
+/* Attaches every tablet that arrived, in order, returns -1 if any of them could not be opened */
+static int t503_libusb_attach_arrived(struct t503_context *ctx) {
+    int retn = 0;
+
+    for (size_t i = 0; i < ctx->libusb_n_arrived; i++) {
+        libusb_device *dev = ctx->libusb_arrived[i];
+        uint64_t start_ns = t503_now_ns();
+        struct t503_device *device = t503_libusb_pick_device(ctx, dev, t503_libusb_profile(dev));
+        t503_startup_step(ctx, "input device");
+
+        if (!device) {
+            errorf("Cannot serve more than %d tablets at once\n", T503_MAX_DEVICES);
+            retn = -1;
+        } else if (t503_libusb_attach(device, dev)) {
+            retn = -1;
+        } else {
+            t503_startup_step(ctx, "open");
+            infof("%s %zu connected in %.1f ms\n", device->profile->name, device->index,
+                (t503_now_ns() - start_ns) / 1e6);
+        }
+        libusb_unref_device(dev);
+    }
+    ctx->libusb_n_arrived = 0;
+    return retn;
+}
+
+/* Called from within libusb event handling, which must not be re-entered, so the work is deferred */
+static int hotplug_cb(libusb_context *usb, libusb_device *dev,
+                      libusb_hotplug_event event, void *user_data) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        /* Every device is reported, only the ones in the profile table are taken */
+        if (ctx->libusb_n_arrived < T503_MAX_DEVICES && t503_libusb_profile(dev) && t503_libusb_wanted(ctx, dev)) {
+            ctx->libusb_arrived[ctx->libusb_n_arrived++] = libusb_ref_device(dev);
+        }
+    } else {
+        for (size_t i = 0; i < ctx->n_devices; i++) {
+            if (ctx->devices[i].libusb_device == dev) ctx->devices[i].libusb_departed = 1;
+        }
+        for (size_t i = 0; i < ctx->libusb_n_arrived; i++) {
+            if (ctx->libusb_arrived[i] != dev) continue;
+            libusb_unref_device(dev);
+            memmove(&ctx->libusb_arrived[i], &ctx->libusb_arrived[i + 1],
+                (--ctx->libusb_n_arrived - i) * sizeof(ctx->libusb_arrived[0]));
+            break;
+        }
+    }
+    t503_reactor_arm_timer(ctx->libusb_work_timer_fd, 1, 0);
+    return 0;
+}
+
+/* Returns 1 while the transfers of a departed tablet are still being reaped */
+static int t503_libusb_detach(struct t503_device *device) {
+    if (!device->libusb_detaching) {
+        errorf("T503 %zu disconnected, waiting for it to come back\n", device->index);
+        device->libusb_detaching = 1;
+        /* Nothing more will come to release what is held down */
+        t503_release_all(device);
+        for (size_t i = 0; i < device->profile->n_endpoints; i++) {
+            device->libusb_recovery[i].n_parked = 0;
+            for (size_t j = 0; j < device->ctx->libusb_n_transfers; j++) {
+                libusb_cancel_transfer(device->libusb_transfers[i][j]);
+            }
+        }
+    }
+    /* transfer_cb runs the work again once the last one is reaped */
+    if (device->libusb_inflight) return 1;
+    t503_libusb_close(device);
+    device->libusb_detaching = 0;
+    return 0;
+}
+
+static void hotplug_work_cb(void *user_data, uint32_t events) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    int detaching = 0;
+
+    /* Opening and closing tablets allocates, unlike handling their reports */
+    int armed = t503_alloc_guard_disarm();
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        struct t503_device *device = &ctx->devices[i];
+        if (device->libusb_departed && device->libusb_handle) {
+            if (t503_libusb_detach(device)) {
+                detaching = 1;
+                continue;
+            }
+        }
+        device->libusb_departed = 0;
+    }
+    /* A tablet plugged back in quickly must find its device free */
+    if (!detaching) t503_libusb_attach_arrived(ctx);
+    if (armed) t503_alloc_guard_arm();
+}
+
+/* Without hotplug support the tablets have to be there from the start */
+static int t503_libusb_scan(struct t503_context *ctx) {
+    libusb_device **devices;
+    ssize_t ndevices = libusb_get_device_list(ctx->libusb_ctx, &devices);
+    if (ndevices < 0) {
+        errorf("T503 Error: %s\n", libusb_strerror((int)ndevices));
+        return -1;
+    }
+
+    for (ssize_t i = 0; i < ndevices; i++) {
+        if (t503_libusb_profile(devices[i])
+            && ctx->libusb_n_arrived < T503_MAX_DEVICES
+            && t503_libusb_wanted(ctx, devices[i])) {
+                ctx->libusb_arrived[ctx->libusb_n_arrived++] = libusb_ref_device(devices[i]);
+        }
+    }
+    libusb_free_device_list(devices, 1);
+    t503_startup_step(ctx, "enumerate");
+
+    if (!ctx->libusb_n_arrived) {
+        errorf("No known tablet found\n");
+        return -1;
+    }
+    return t503_libusb_attach_arrived(ctx);
+}
+
+static int t503_init_libusb(struct t503_context *ctx, struct t503_options const *opts) {
+    ctx->libusb_ctx = NULL;
+    ctx->libusb_stopping = 0;
+    ctx->libusb_started = 0;
+    ctx->libusb_poll_failed = 0;
+    ctx->libusb_hotplug_registered = 0;
+    ctx->libusb_work_timer_fd = -1;
+    ctx->libusb_n_arrived = 0;
+    ctx->libusb_n_endpoints = 0;
+    ctx->libusb_n_transfers = opts->n_transfers ? opts->n_transfers : T503_N_TRANSFERS;
+
+    ctx->libusb_n_paths = opts->n_usb_paths;
+    for (size_t i = 0; i < opts->n_usb_paths; i++) {
+        ctx->libusb_path_lengths[i] = t503_libusb_parse_path(opts->usb_paths[i], ctx->libusb_paths[i]);
+        if (ctx->libusb_path_lengths[i] < 0) {
+            errorf("%s is not a USB port like 1-2.3\n", opts->usb_paths[i]);
+            return -1;
+        }
+    }
+
+    int retn = libusb_init(&ctx->libusb_ctx);
+    if (retn) goto error_libusb_init;
+
+    const struct libusb_pollfd **pollfds = libusb_get_pollfds(ctx->libusb_ctx);
+    if (!pollfds) {
+        retn = 4;
+        goto error_libusb_get_pollfds;
+    }
+    for (size_t i = 0; pollfds[i]; i++) {
+        libusb_pollfd_added(pollfds[i]->fd, pollfds[i]->events, ctx);
+    }
+    if (ctx->libusb_poll_failed) {
+        for (size_t i = 0; pollfds[i]; i++) t503_reactor_remove(&ctx->reactor, pollfds[i]->fd);
+    }
+    libusb_free_pollfds(pollfds);
+    if (ctx->libusb_poll_failed) {
+        retn = 4;
+        goto error_libusb_get_pollfds;
+    }
+    libusb_set_pollfd_notifiers(ctx->libusb_ctx, libusb_pollfd_added, libusb_pollfd_removed, ctx);
+    t503_startup_step(ctx, "libusb_init");
+
+    ctx->libusb_work_timer_fd = t503_reactor_add_timer(&ctx->reactor, 0, hotplug_work_cb, ctx);
+    if (ctx->libusb_work_timer_fd == -1) {
+        retn = 5;
+        goto error_add_timer;
+    }
+
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        if (t503_libusb_scan(ctx)) goto error_attach;
+        return 0;
+    }
+
+    /* Tablets already plugged in are reported right away */
+    retn = libusb_hotplug_register_callback(
+        ctx->libusb_ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+        LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplug_cb, (void *)ctx, &ctx->libusb_hotplug
+    );
+    if (retn) goto error_libusb_hotplug_register_callback;
+    ctx->libusb_hotplug_registered = 1;
+    t503_startup_step(ctx, "enumerate");
+
+    if (!ctx->libusb_n_arrived) {
+        infof("No known tablet found, waiting for one to be plugged in\n");
+        return 0;
+    }
+    /* A tablet present at startup that cannot be opened is still an error */
+    if (t503_libusb_attach_arrived(ctx)) goto error_attach;
+    return 0;
+
+/* Warning: the label below should be in reversed order compared to the corresponding above */
+
+error_attach:
+    if (ctx->libusb_hotplug_registered) {
+        libusb_hotplug_deregister_callback(ctx->libusb_ctx, ctx->libusb_hotplug);
+        ctx->libusb_hotplug_registered = 0;
+    }
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        if (ctx->devices[i].libusb_handle) t503_libusb_close(&ctx->devices[i]);
+        t503_libusb_teardown(&ctx->devices[i]);
+    }
+    retn = 1;
+error_libusb_hotplug_register_callback:
+    t503_reactor_remove_timer(&ctx->reactor, ctx->libusb_work_timer_fd);
+    ctx->libusb_work_timer_fd = -1;
+error_add_timer:
+    libusb_set_pollfd_notifiers(ctx->libusb_ctx, NULL, NULL, NULL);
+error_libusb_get_pollfds:
+    libusb_exit(ctx->libusb_ctx);
+error_libusb_init:
+    if (retn < 0) {
+        errorf("T503 Error: %s\n", libusb_strerror(retn));
+    } else {
+        errorf("Some error happens, position = %d\n", retn);
+    }
+    return -1;
+}
+
+static int t503_start_libusb(struct t503_context *ctx) {
+    ctx->libusb_stopping = 0;
+    ctx->libusb_started = 1;
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        if (ctx->devices[i].libusb_handle) t503_libusb_submit_all(&ctx->devices[i]);
+    }
+    /* With hotplug the transfers are submitted as soon as a tablet shows up */
+    if (ctx->libusb_hotplug_registered || t503_libusb_inflight(ctx)) return 0;
+
+    t503_stop_libusb(ctx);
+    return -1;
+}
+
+static void t503_stop_libusb(struct t503_context *ctx) {
+    ctx->libusb_stopping = 1;
+    ctx->libusb_started = 0;
+    for (size_t i = 0; i < ctx->n_devices; i++) {
+        struct t503_device *device = &ctx->devices[i];
+        for (size_t j = 0; j < T503_N_ENDPOINTS; j++) {
+            struct t503_libusb_recovery *recovery = &device->libusb_recovery[j];
+            if (recovery->timer_fd != -1) t503_reactor_arm_timer(recovery->timer_fd, 0, 0);
+            recovery->n_parked = 0;
+        }
+
+        /* The transfers still point at the handle of a tablet that is gone */
+        if (!device->libusb_handle) continue;
+        for (size_t j = 0; j < device->profile->n_endpoints; j++) {
+            for (size_t k = 0; k < ctx->libusb_n_transfers; k++) {
+                libusb_cancel_transfer(device->libusb_transfers[j][k]);
+            }
+        }
+    }
+    /* Cancellations are reaped through the same pollfds, give up if the devices went silent */
+    while (t503_libusb_inflight(ctx)) {
+        if (t503_reactor_run_once(&ctx->reactor, 1000) <= 0) break;
+    }
+}
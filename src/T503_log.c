@@ -0,0 +1,407 @@
+#include "T503_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+
+/* Messages queued for the logger thread, a power of two */
+#define T503_LOG_RING_SIZE 1024
+#define T503_LOG_MAX_ARGS 8
+#define T503_LOG_TEXT_SIZE 64
+#define T503_LOG_SPEC_SIZE 48
+#define T503_CACHE_LINE 64
+/* Also bounds the memory locked in real-time mode */
+#define T503_LOG_STACK_SIZE (64 * 1024)
+
+#define T503_LOG_NONE (-1)
+#define T503_LOG_STAR (-2)
+
+enum t503_log_length {
+    T503_LOG_LENGTH_NONE,
+    T503_LOG_LENGTH_HH,
+    T503_LOG_LENGTH_H,
+    T503_LOG_LENGTH_L,
+    T503_LOG_LENGTH_LL,
+    T503_LOG_LENGTH_Z,
+    T503_LOG_LENGTH_J,
+    T503_LOG_LENGTH_T,
+    T503_LOG_LENGTH_BIG_L,
+};
+
+/* One conversion of a format string */
+struct t503_log_spec {
+    const char *flags;
+    size_t n_flags;
+    int width;
+    int precision;
+    enum t503_log_length length;
+    char conversion;
+};
+
+union t503_log_arg {
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+};
+
+struct t503_log_record {
+    const char *fmt;
+    uint8_t level;
+    uint8_t n_args;
+    uint8_t text_size;
+    union t503_log_arg args[T503_LOG_MAX_ARGS];
+    /* Copies of the %s arguments, args holds their offsets */
+    char text[T503_LOG_TEXT_SIZE];
+};
+
+struct t503_log_ring {
+    /* Written by the logging thread */
+    size_t head __attribute__((aligned(T503_CACHE_LINE)));
+    uint64_t dropped;
+
+    /* Written by the logger thread */
+    size_t tail __attribute__((aligned(T503_CACHE_LINE)));
+    uint64_t reported_dropped;
+    int sleeping;
+
+    struct t503_log_record records[T503_LOG_RING_SIZE] __attribute__((aligned(T503_CACHE_LINE)));
+};
+
+int g_t503_log_level = T503_LOG_DEFAULT_LEVEL;
+
+static struct t503_log_ring s_ring;
+static pthread_t s_thread;
+static int s_running;
+static int s_stop;
+static int s_event_fd = -1;
+
+
+static void t503_log_wake(void) {
+    uint64_t one = 1;
+    /* Only fails if the counter overflows, the thread is awake by then */
+    ssize_t retn = write(s_event_fd, &one, sizeof(one));
+    (void)retn;
+}
+
+static const char *t503_log_parse(const char *percent, struct t503_log_spec *spec) {
+    const char *p = percent + 1;
+
+    spec->flags = p;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    spec->n_flags = p - spec->flags;
+
+    spec->width = T503_LOG_NONE;
+    if (*p == '*') {
+        spec->width = T503_LOG_STAR;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        for (spec->width = 0; *p >= '0' && *p <= '9'; p++) spec->width = spec->width * 10 + *p - '0';
+    }
+
+    spec->precision = T503_LOG_NONE;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->precision = T503_LOG_STAR;
+            p++;
+        } else {
+            for (spec->precision = 0; *p >= '0' && *p <= '9'; p++) spec->precision = spec->precision * 10 + *p - '0';
+        }
+    }
+
+    spec->length = T503_LOG_LENGTH_NONE;
+    switch (*p) {
+    case 'h':
+        spec->length = p[1] == 'h' ? T503_LOG_LENGTH_HH : T503_LOG_LENGTH_H;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        spec->length = p[1] == 'l' ? T503_LOG_LENGTH_LL : T503_LOG_LENGTH_L;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'z': spec->length = T503_LOG_LENGTH_Z; p++; break;
+    case 'j': spec->length = T503_LOG_LENGTH_J; p++; break;
+    case 't': spec->length = T503_LOG_LENGTH_T; p++; break;
+    case 'L': spec->length = T503_LOG_LENGTH_BIG_L; p++; break;
+    }
+
+    spec->conversion = *p;
+    return *p ? p + 1 : p;
+}
+
+static long long t503_log_va_signed(enum t503_log_length length, va_list *args) {
+    switch (length) {
+    case T503_LOG_LENGTH_HH: return (signed char)va_arg(*args, int);
+    case T503_LOG_LENGTH_H: return (short)va_arg(*args, int);
+    case T503_LOG_LENGTH_L: return va_arg(*args, long);
+    case T503_LOG_LENGTH_LL: return va_arg(*args, long long);
+    case T503_LOG_LENGTH_Z: return va_arg(*args, ssize_t);
+    case T503_LOG_LENGTH_J: return va_arg(*args, intmax_t);
+    case T503_LOG_LENGTH_T: return va_arg(*args, ptrdiff_t);
+    default: return va_arg(*args, int);
+    }
+}
+
+static unsigned long long t503_log_va_unsigned(enum t503_log_length length, va_list *args) {
+    switch (length) {
+    case T503_LOG_LENGTH_HH: return (unsigned char)va_arg(*args, unsigned int);
+    case T503_LOG_LENGTH_H: return (unsigned short)va_arg(*args, unsigned int);
+    case T503_LOG_LENGTH_L: return va_arg(*args, unsigned long);
+    case T503_LOG_LENGTH_LL: return va_arg(*args, unsigned long long);
+    case T503_LOG_LENGTH_Z: return va_arg(*args, size_t);
+    case T503_LOG_LENGTH_J: return va_arg(*args, uintmax_t);
+    case T503_LOG_LENGTH_T: return (unsigned long long)va_arg(*args, ptrdiff_t);
+    default: return va_arg(*args, unsigned int);
+    }
+}
+
+static void t503_log_capture_string(struct t503_log_record *record, const char *str) {
+    if (!str) str = "(null)";
+    size_t size = strnlen(str, T503_LOG_TEXT_SIZE - 1 - record->text_size);
+    record->args[record->n_args++].u = record->text_size;
+    memcpy(&record->text[record->text_size], str, size);
+    record->text[record->text_size + size] = '\0';
+    /* Later strings are cut to nothing once the buffer is full */
+    if (record->text_size + size + 1 < T503_LOG_TEXT_SIZE) record->text_size += size + 1;
+}
+
+/* Pulls the arguments out of the va_list with the types the format gives them */
+static void t503_log_capture(struct t503_log_record *record, const char *fmt, va_list *args) {
+    struct t503_log_spec spec;
+
+    record->n_args = 0;
+    record->text_size = 0;
+    for (const char *p = fmt; (p = strchr(p, '%'));) {
+        p = t503_log_parse(p, &spec);
+        size_t needed = (spec.width == T503_LOG_STAR) + (spec.precision == T503_LOG_STAR) + (spec.conversion != '%');
+        if (record->n_args + needed > T503_LOG_MAX_ARGS) return;
+
+        if (spec.width == T503_LOG_STAR) record->args[record->n_args++].i = va_arg(*args, int);
+        if (spec.precision == T503_LOG_STAR) record->args[record->n_args++].i = va_arg(*args, int);
+
+        switch (spec.conversion) {
+        case '%':
+            break;
+        case 'd': case 'i':
+            record->args[record->n_args++].i = t503_log_va_signed(spec.length, args);
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            record->args[record->n_args++].u = t503_log_va_unsigned(spec.length, args);
+            break;
+        case 'c':
+            record->args[record->n_args++].i = va_arg(*args, int);
+            break;
+        case 's':
+            t503_log_capture_string(record, va_arg(*args, const char *));
+            break;
+        case 'p':
+            record->args[record->n_args++].p = va_arg(*args, const void *);
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            record->args[record->n_args++].d = spec.length == T503_LOG_LENGTH_BIG_L
+                ? (double)va_arg(*args, long double) : va_arg(*args, double);
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+/* Prints one conversion with the captured arguments, returns 0 if they ran out */
+static int t503_log_format(FILE *file, struct t503_log_spec const *spec,
+                           struct t503_log_record const *record, size_t *arg) {
+    char format[T503_LOG_SPEC_SIZE];
+    int width = spec->width;
+    int precision = spec->precision;
+    const char *length = "";
+
+    if (spec->conversion == '%') {
+        fputc('%', file);
+        return 1;
+    }
+
+    if (!spec->conversion || !strchr("diuoxXcspfFeEgGaA", spec->conversion)) return 0;
+    size_t needed = (width == T503_LOG_STAR) + (precision == T503_LOG_STAR) + 1;
+    if (*arg + needed > record->n_args) return 0;
+    if (width == T503_LOG_STAR) width = (int)record->args[(*arg)++].i;
+    if (precision == T503_LOG_STAR) precision = (int)record->args[(*arg)++].i;
+    union t503_log_arg value = record->args[(*arg)++];
+
+    if (strchr("diuoxX", spec->conversion)) length = "ll";
+
+    int size = snprintf(format, sizeof(format), "%%%.*s", (int)spec->n_flags, spec->flags);
+    if (width >= 0) size += snprintf(format + size, sizeof(format) - size, "%d", width);
+    if (precision >= 0) size += snprintf(format + size, sizeof(format) - size, ".%d", precision);
+    snprintf(format + size, sizeof(format) - size, "%s%c", length, spec->conversion);
+
+    switch (spec->conversion) {
+    case 'd': case 'i':
+        fprintf(file, format, value.i);
+        break;
+    case 'c':
+        fprintf(file, format, (int)value.i);
+        break;
+    case 's':
+        fprintf(file, format, &record->text[value.u]);
+        break;
+    case 'p':
+        fprintf(file, format, value.p);
+        break;
+    case 'u': case 'o': case 'x': case 'X':
+        fprintf(file, format, value.u);
+        break;
+    default:
+        fprintf(file, format, value.d);
+    }
+    return 1;
+}
+
+static void t503_log_print(struct t503_log_record const *record) {
+    FILE *file = record->level == T503_LOG_ERROR ? stderr : stdout;
+    struct t503_log_spec spec;
+    const char *p = record->fmt;
+    const char *percent;
+    size_t arg = 0;
+
+    while ((percent = strchr(p, '%'))) {
+        fwrite(p, 1, percent - p, file);
+        const char *end = t503_log_parse(percent, &spec);
+        /* Unsupported conversions and what follows them are printed as they are */
+        if (!t503_log_format(file, &spec, record, &arg)) {
+            p = percent;
+            break;
+        }
+        p = end;
+    }
+    fputs(p, file);
+}
+
+static size_t t503_log_drain(void) {
+    size_t tail = s_ring.tail;
+    size_t head = __atomic_load_n(&s_ring.head, __ATOMIC_ACQUIRE);
+
+    for (size_t i = tail; i != head; i++) {
+        t503_log_print(&s_ring.records[i & (T503_LOG_RING_SIZE - 1)]);
+    }
+
+    uint64_t dropped = __atomic_load_n(&s_ring.dropped, __ATOMIC_RELAXED);
+    if (dropped != s_ring.reported_dropped) {
+        fprintf(stderr, "%llu log messages dropped\n", (unsigned long long)(dropped - s_ring.reported_dropped));
+        s_ring.reported_dropped = dropped;
+    }
+    if (head != tail) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    /* Only after the flush, so that t503_log_flush() returns once the messages are out */
+    __atomic_store_n(&s_ring.tail, head, __ATOMIC_RELEASE);
+    return head - tail;
+}
+
+/*
+ * Sleeps on the eventfd while the ring is empty. The producer only writes to the eventfd when it
+ * sees the thread sleeping, so a busy logger costs the producer no system call.
+ */
+static void *t503_log_thread(void *arg) {
+    uint64_t value;
+
+    for (;;) {
+        if (t503_log_drain()) continue;
+        if (__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) break;
+
+        __atomic_store_n(&s_ring.sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&s_ring.head, __ATOMIC_RELAXED) == s_ring.tail
+            && !__atomic_load_n(&s_stop, __ATOMIC_RELAXED)) {
+            if (read(s_event_fd, &value, sizeof(value)) == -1 && errno != EINTR) break;
+        }
+        __atomic_store_n(&s_ring.sleeping, 0, __ATOMIC_RELAXED);
+    }
+    t503_log_drain();
+    return NULL;
+}
+
+void t503_log_write(enum t503_log_level level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    if (!__atomic_load_n(&s_running, __ATOMIC_ACQUIRE)) {
+        vfprintf(level == T503_LOG_ERROR ? stderr : stdout, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    size_t head = s_ring.head;
+    if (head - __atomic_load_n(&s_ring.tail, __ATOMIC_ACQUIRE) == T503_LOG_RING_SIZE) {
+        __atomic_store_n(&s_ring.dropped, s_ring.dropped + 1, __ATOMIC_RELAXED);
+        va_end(args);
+        return;
+    }
+
+    struct t503_log_record *record = &s_ring.records[head & (T503_LOG_RING_SIZE - 1)];
+    record->fmt = fmt;
+    record->level = level;
+    t503_log_capture(record, fmt, &args);
+    va_end(args);
+
+    __atomic_store_n(&s_ring.head, head + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s_ring.sleeping, __ATOMIC_RELAXED)) t503_log_wake();
+}
+
+void t503_log_flush(void) {
+    if (!s_running) return;
+
+    size_t head = s_ring.head;
+    t503_log_wake();
+    while (__atomic_load_n(&s_ring.tail, __ATOMIC_ACQUIRE) != head) sched_yield();
+}
+
+int t503_log_start(void) {
+    sigset_t all, previous;
+    pthread_attr_t attr;
+
+    s_event_fd = eventfd(0, EFD_CLOEXEC);
+    if (s_event_fd == -1) goto error_eventfd;
+    s_stop = 0;
+
+    /* Signals are read from a signalfd by the event loop, they must never land on the logger */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, T503_LOG_STACK_SIZE);
+    int retn = pthread_create(&s_thread, &attr, t503_log_thread, NULL);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (retn) goto error_pthread_create;
+
+    __atomic_store_n(&s_running, 1, __ATOMIC_RELEASE);
+    return 0;
+
+error_pthread_create:
+    close(s_event_fd);
+    s_event_fd = -1;
+error_eventfd:
+    errorf("Cannot start the logger thread, logging synchronously\n");
+    return -1;
+}
+
+void t503_log_stop(void) {
+    if (!s_running) return;
+
+    __atomic_store_n(&s_stop, 1, __ATOMIC_RELEASE);
+    t503_log_wake();
+    pthread_join(s_thread, NULL);
+
+    __atomic_store_n(&s_running, 0, __ATOMIC_RELEASE);
+    close(s_event_fd);
+    s_event_fd = -1;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdio.h>
+
+enum t503_log_level {
+    T503_LOG_ERROR,
+    T503_LOG_INFO,
+    T503_LOG_DEBUG,
+};
+
+/* Debug builds keep printing everything by default, release builds only errors */
+#ifdef NDEBUG
+#define T503_LOG_DEFAULT_LEVEL T503_LOG_ERROR
+#else
+#define T503_LOG_DEFAULT_LEVEL T503_LOG_DEBUG
+#endif
+
+extern int g_t503_log_level;
+
+#define t503_log_enabled(level) __builtin_expect((level) <= g_t503_log_level, 0)
+
+/* Arguments are only evaluated when the level is enabled */
+#define t503_log(level, ...) \
+    do { \
+        if (t503_log_enabled(level)) t503_log_write(level, __VA_ARGS__); \
+    } while (0)
+
+#define debugf(...) t503_log(T503_LOG_DEBUG, __VA_ARGS__)
+#define infof(...) t503_log(T503_LOG_INFO, __VA_ARGS__)
+#define errorf(...) t503_log(T503_LOG_ERROR, __VA_ARGS__)
+
+/*
+ * While the logger thread runs, a message is queued as its format and raw arguments and formatted
+ * by the thread, strings are copied up to T503_LOG_TEXT_SIZE bytes per message.
+ * Otherwise it is printed right away. Only one thread may log while the logger thread runs.
+ */
+void t503_log_write(enum t503_log_level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+int t503_log_start(void);
+/* Prints the queued messages before returning */
+void t503_log_stop(void);
+/* Waits until the queued messages are printed, for output written around the logger */
+void t503_log_flush(void);
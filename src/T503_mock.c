@@ -0,0 +1,162 @@
+#include "T503.h"
+#include "T503_log.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static int t503_init_mock(struct t503_context *, struct t503_options const *);
+static void t503_exit_mock(struct t503_context *);
+static int t503_start_mock(struct t503_context *);
+static void t503_stop_mock(struct t503_context *);
+
+static int t503_init_capture(struct t503_context *, struct t503_options const *);
+static void t503_exit_capture(struct t503_context *);
+static int t503_open_capture(struct t503_device *);
+static void t503_close_capture(struct t503_device *);
+static int t503_write_capture(struct t503_device *, size_t, const struct input_event *, size_t);
+
+static void mock_cb(void *, uint32_t);
+
+const struct t503_source_ops t503_source_mock = {
+    "mock",
+    t503_init_mock,
+    t503_exit_mock,
+    t503_start_mock,
+    t503_stop_mock,
+    NULL,
+};
+
+const struct t503_sink_ops t503_sink_capture = {
+    "capture",
+    t503_init_capture,
+    t503_exit_capture,
+    t503_open_capture,
+    t503_close_capture,
+    t503_write_capture,
+};
+
+
+static int t503_init_mock(struct t503_context *ctx, struct t503_options const *opts) {
+    struct t503_mock_source *mock = ctx->mock;
+    if (!mock) {
+        errorf("The mock source needs reports to feed\n");
+        return -1;
+    }
+    mock->position = 0;
+    mock->loop = 0;
+    mock->start_ns = 0;
+    mock->timer_fd = -1;
+
+    /* A device for every tablet of the capture, all of them the same model */
+    size_t n_devices = 1;
+    for (size_t i = 0; i < mock->n_reports; i++) {
+        if (mock->reports[i].device >= n_devices) n_devices = mock->reports[i].device + 1;
+    }
+    if (n_devices > T503_MAX_DEVICES) {
+        errorf("The capture has reports of %zu tablets, at most %d can be replayed\n", n_devices, T503_MAX_DEVICES);
+        return -1;
+    }
+    for (size_t i = 0; i < n_devices; i++) {
+        if (!t503_add_device(ctx, opts->profile ? opts->profile : t503_profile_default())) return -1;
+    }
+    return 0;
+}
+
+static void t503_exit_mock(struct t503_context *ctx) {
+}
+
+static int t503_start_mock(struct t503_context *ctx) {
+    struct t503_mock_source *mock = ctx->mock;
+    mock->timer_fd = t503_reactor_add_timer(&ctx->reactor, 0, mock_cb, ctx);
+    if (mock->timer_fd == -1) return -1;
+
+    mock->start_ns = t503_now_ns();
+    return t503_reactor_arm_timer(mock->timer_fd, 1, 0);
+}
+
+static void t503_stop_mock(struct t503_context *ctx) {
+    struct t503_mock_source *mock = ctx->mock;
+    if (mock->timer_fd == -1) return;
+    t503_reactor_remove_timer(&ctx->reactor, mock->timer_fd);
+    mock->timer_fd = -1;
+}
+
+/* Time left until the current report is due, relative to the first report of the loop */
+static uint64_t t503_mock_delay(struct t503_mock_source const *mock, uint64_t now) {
+    uint64_t offset = mock->reports[mock->position].timestamp_ns - mock->reports[0].timestamp_ns;
+    uint64_t elapsed = now - mock->start_ns;
+    return offset > elapsed ? offset - elapsed : 0;
+}
+
+/*
+ * Feeds at most one batch per timer expiration so that signals are still handled in between.
+ * In realtime mode the timer is re-armed for the next report that is not due yet.
+ */
+static void mock_cb(void *user_data, uint32_t events) {
+    struct t503_context *ctx = (struct t503_context *)user_data;
+    struct t503_mock_source *mock = ctx->mock;
+    size_t n_loops = mock->n_loops ? mock->n_loops : 1;
+    uint64_t delay = 1;
+
+    for (size_t i = 0; i < T503_MOCK_BATCH; i++) {
+        if (mock->position == mock->n_reports) {
+            mock->position = 0;
+            mock->start_ns = t503_now_ns();
+            if (++mock->loop >= n_loops || !mock->n_reports) {
+                ctx->reactor.should_exit = 1;
+                return;
+            }
+        }
+
+        if (mock->realtime) {
+            delay = t503_mock_delay(mock, t503_now_ns());
+            if (delay) break;
+            delay = 1;
+        }
+
+        const struct t503_mock_report *report = &mock->reports[mock->position++];
+        t503_handle_report(&ctx->devices[report->device], report->endpoint % T503_N_ENDPOINTS, report->data,
+                           report->length, t503_now_ns());
+    }
+    t503_reactor_arm_timer(mock->timer_fd, delay, 0);
+}
+
+static int t503_init_capture(struct t503_context *ctx, struct t503_options const *opts) {
+    struct t503_capture_sink *capture = ctx->capture;
+    if (!capture) {
+        errorf("The capture sink needs somewhere to record to\n");
+        return -1;
+    }
+    capture->n_events = 0;
+    capture->n_frames = 0;
+    capture->n_dropped = 0;
+    return 0;
+}
+
+static void t503_exit_capture(struct t503_context *ctx) {
+}
+
+/* All devices and both of their nodes are captured into the same buffer */
+static int t503_open_capture(struct t503_device *device) {
+    return 0;
+}
+
+static void t503_close_capture(struct t503_device *device) {
+}
+
+static int t503_write_capture(struct t503_device *device, size_t node, const struct input_event *events,
+                              size_t n_events) {
+    struct t503_capture_sink *capture = device->ctx->capture;
+    size_t n_copied = 0;
+
+    if (capture->events && capture->n_events < capture->capacity) {
+        n_copied = capture->capacity - capture->n_events;
+        if (n_copied > n_events) n_copied = n_events;
+        memcpy(&capture->events[capture->n_events], events, n_copied * sizeof(struct input_event));
+    }
+    capture->n_events += n_copied;
+    capture->n_dropped += n_events - n_copied;
+    capture->n_frames++;
+    return 0;
+}
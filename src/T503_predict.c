@@ -0,0 +1,90 @@
+#include "T503.h"
+#include "T503_predict.h"
+#include <math.h>
+#include <string.h>
+
+/* Cutoff of the speed estimate of the 1-euro filter, in Hz */
+#define T503_PREDICT_SPEED_CUTOFF 1.0
+
+
+void t503_predictor_reset(struct t503_predictor *predictor) {
+    memset(predictor, 0, sizeof(*predictor));
+}
+
+/* Smoothing factor of a first order low-pass filter with the given cutoff frequency */
+static double t503_lowpass_alpha(double cutoff, double dt) {
+    double tau = 1 / (2 * M_PI * cutoff);
+    return 1 / (1 + tau / dt);
+}
+
+static struct t503_predict_sample const *t503_predict_sample(struct t503_predictor const *predictor, size_t age) {
+    return &predictor->samples[(predictor->next + T503_PREDICT_SAMPLES - 1 - age) % T503_PREDICT_SAMPLES];
+}
+
+/* Slope of the position between two samples, in units per second */
+static void t503_predict_velocity(struct t503_predict_sample const *from, struct t503_predict_sample const *to,
+                                  double velocity[2]) {
+    double dt = (to->t_ns - from->t_ns) / 1e9;
+    for (size_t i = 0; i < 2; i++) {
+        velocity[i] = (to->position[i] - from->position[i]) / dt;
+    }
+}
+
+static uint16_t t503_predict_clamp(double value, uint16_t max) {
+    return value < 0 ? 0 : value > max ? max : (uint16_t)lround(value);
+}
+
+void t503_predict(struct t503_predictor *predictor, struct t503_prediction const *settings, uint64_t t_ns,
+                  uint16_t x, uint16_t y, uint16_t const max[2], uint16_t out[2]) {
+    double position[2] = { x, y };
+
+    if (predictor->n_samples) {
+        struct t503_predict_sample const *last = t503_predict_sample(predictor, 0);
+        if (t_ns <= last->t_ns || t_ns - last->t_ns > T503_PREDICT_MAX_GAP_NS) t503_predictor_reset(predictor);
+    }
+
+    /* 1-euro filter: the faster the pen moves, the higher the cutoff, so that jitter is smoothed without lag */
+    if (settings->min_cutoff > 0 && predictor->n_samples) {
+        struct t503_predict_sample const *last = t503_predict_sample(predictor, 0);
+        double dt = (t_ns - last->t_ns) / 1e9;
+        for (size_t i = 0; i < 2; i++) {
+            double speed = fabs(position[i] - last->position[i]) / dt;
+            predictor->speed[i] += t503_lowpass_alpha(T503_PREDICT_SPEED_CUTOFF, dt) * (speed - predictor->speed[i]);
+            double cutoff = settings->min_cutoff + settings->beta * predictor->speed[i];
+            position[i] = last->position[i] + t503_lowpass_alpha(cutoff, dt) * (position[i] - last->position[i]);
+        }
+    }
+
+    struct t503_predict_sample *sample = &predictor->samples[predictor->next];
+    sample->t_ns = t_ns;
+    sample->position[0] = position[0];
+    sample->position[1] = position[1];
+    predictor->next = (predictor->next + 1) % T503_PREDICT_SAMPLES;
+    if (predictor->n_samples < T503_PREDICT_SAMPLES) predictor->n_samples++;
+
+    /* Constant velocity over the whole window, or the velocity of its recent half and how it changed */
+    double lead = settings->lead_ns / 1e9;
+    size_t n = predictor->n_samples;
+    if (settings->mode == T503_PREDICT_ACCELERATION && n >= 3) {
+        struct t503_predict_sample const *oldest = t503_predict_sample(predictor, n - 1);
+        struct t503_predict_sample const *middle = t503_predict_sample(predictor, n / 2);
+        double early[2], late[2];
+        t503_predict_velocity(oldest, middle, early);
+        t503_predict_velocity(middle, sample, late);
+        double dt = (sample->t_ns - oldest->t_ns) / 2e9;
+        double now = (sample->t_ns - middle->t_ns) / 2e9 + lead;
+        for (size_t i = 0; i < 2; i++) {
+            double acceleration = (late[i] - early[i]) / dt;
+            position[i] += late[i] * lead + acceleration * (now * now - (now - lead) * (now - lead)) / 2;
+        }
+    } else if (settings->mode != T503_PREDICT_OFF && n >= 2) {
+        double velocity[2];
+        t503_predict_velocity(t503_predict_sample(predictor, n - 1), sample, velocity);
+        for (size_t i = 0; i < 2; i++) {
+            position[i] += velocity[i] * lead;
+        }
+    }
+
+    out[0] = t503_predict_clamp(position[0], max[0]);
+    out[1] = t503_predict_clamp(position[1], max[1]);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "T503_config.h"
+
+/* Filtered samples kept to estimate the velocity and acceleration of the pen */
+#define T503_PREDICT_SAMPLES 4
+/* A longer gap between two positions starts a new stroke */
+#define T503_PREDICT_MAX_GAP_NS 50000000ull
+
+struct t503_predict_sample {
+    uint64_t t_ns;
+    double position[2];
+};
+
+/* State of one pen, positions are raw tablet coordinates */
+struct t503_predictor {
+    struct t503_predict_sample samples[T503_PREDICT_SAMPLES];
+    size_t n_samples;
+    size_t next;
+    /* Low-passed speed of each axis in units per second, drives the cutoff of the 1-euro filter */
+    double speed[2];
+};
+
+static inline int t503_prediction_enabled(struct t503_prediction const *prediction) {
+    return prediction->mode != T503_PREDICT_OFF || prediction->min_cutoff > 0;
+}
+
+void t503_predictor_reset(struct t503_predictor *);
+/* Smooths a position and extrapolates it by the lead of the settings, out is clamped to the tablet size max */
+void t503_predict(struct t503_predictor *, struct t503_prediction const *, uint64_t t_ns,
+                  uint16_t x, uint16_t y, uint16_t const max[2], uint16_t out[2]);
@@ -0,0 +1,72 @@
+#include "T503_profile.h"
+#include "T503.h"
+#include <string.h>
+
+#define T503_ALL_BUTTONS (T503_BUTTON_BIT_1 | T503_BUTTON_BIT_2 | T503_BUTTON_BIT_3 | T503_BUTTON_BIT_4 \
+                          | T503_BUTTON_BIT_PLUS | T503_BUTTON_BIT_MINUS)
+
+/* The first entry is the default */
+static const struct t503_profile s_profiles[] = {
+    {
+        .name = "t503",
+        .vendor = 0x08f2,
+        .product = 0x6811,
+        .interfaces = { 1, 2 },
+        .n_endpoints = 2,
+        .max_x = 4095,
+        .max_y = 4095,
+        .max_pressure = 2047,
+        .resolution_x = 2,
+        .resolution_y = 3,
+        .buttons = T503_ALL_BUTTONS,
+        .mirror_x = 1,
+        .format = T503_FORMAT_10MOONS,
+    },
+    /*
+     * Pen and frame buttons both come through interface 0, ranges from the specifications. It sends
+     * report 0x07 only once string 100 has been read, as the kernel uclogic driver does when it binds.
+     */
+    {
+        .name = "huion-h420",
+        .vendor = 0x256c,
+        .product = 0x006e,
+        .interfaces = { 0 },
+        .n_endpoints = 1,
+        .max_x = 16000,
+        .max_y = 8920,
+        .max_pressure = 2047,
+        .resolution_x = 157,
+        .resolution_y = 157,
+        .buttons = T503_BUTTON_BIT_1 | T503_BUTTON_BIT_2 | T503_BUTTON_BIT_3,
+        .mirror_x = 0,
+        .format = T503_FORMAT_UCLOGIC,
+        .init_string = 100,
+    },
+};
+
+static const t503_decode_fn s_decoders[] = {
+    [T503_FORMAT_10MOONS] = t503_decode_10moons,
+    [T503_FORMAT_UCLOGIC] = t503_decode_uclogic,
+};
+
+const struct t503_profile *t503_profile_default(void) {
+    return &s_profiles[0];
+}
+
+const struct t503_profile *t503_profile_find(uint16_t vendor, uint16_t product) {
+    for (size_t i = 0; i < T503_COUNT_OF(s_profiles); i++) {
+        if (s_profiles[i].vendor == vendor && s_profiles[i].product == product) return &s_profiles[i];
+    }
+    return NULL;
+}
+
+const struct t503_profile *t503_profile_named(const char *name) {
+    for (size_t i = 0; i < T503_COUNT_OF(s_profiles); i++) {
+        if (!strcmp(s_profiles[i].name, name)) return &s_profiles[i];
+    }
+    return NULL;
+}
+
+t503_decode_fn t503_profile_decoder(struct t503_profile const *profile) {
+    return s_decoders[profile->format];
+}
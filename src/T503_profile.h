@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "T503_decode.h"
+
+/* Endpoints read per tablet at most, the profile says how many it has */
+#define T503_N_ENDPOINTS 2
+
+/* Report layouts, each one is decoded by its own function */
+enum t503_report_format {
+    T503_FORMAT_10MOONS,
+    T503_FORMAT_UCLOGIC,
+};
+
+typedef int (*t503_decode_fn)(const uint8_t *data, int length, struct t503_report *report);
+
+/* What differs between the supported tablets, adding one is adding an entry to the table */
+struct t503_profile {
+    const char *name;
+    uint16_t vendor;
+    uint16_t product;
+    /* Interface read by each endpoint, only the first n_endpoints are used */
+    uint8_t interfaces[T503_N_ENDPOINTS];
+    uint8_t n_endpoints;
+    uint16_t max_x;
+    uint16_t max_y;
+    uint16_t max_pressure;
+    /* Units per millimeter */
+    uint16_t resolution_x;
+    uint16_t resolution_y;
+    /* Pad buttons of the tablet as T503_BUTTON_BIT_* */
+    uint8_t buttons;
+    /* The tablet reports x growing from right to left */
+    uint8_t mirror_x;
+    enum t503_report_format format;
+    /* String descriptor read once the tablet is opened, which switches it to the report format, 0 for none */
+    uint8_t init_string;
+};
+
+/* The T503, used when nothing says which tablet reports come from */
+const struct t503_profile *t503_profile_default(void);
+/* NULL for a tablet that is not in the table */
+const struct t503_profile *t503_profile_find(uint16_t vendor, uint16_t product);
+const struct t503_profile *t503_profile_named(const char *name);
+/* Decoder of the report format of a profile, looked up once per tablet */
+t503_decode_fn t503_profile_decoder(struct t503_profile const *);
@@ -0,0 +1,160 @@
+#include "T503_reactor.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+
+static struct t503_reactor_handler *t503_reactor_find(struct t503_reactor *reactor, int fd) {
+    for (size_t i = 0; i < T503_REACTOR_MAX_HANDLERS; i++) {
+        if (reactor->handlers[i].fd == fd) return &reactor->handlers[i];
+    }
+    return NULL;
+}
+
+int t503_reactor_init(struct t503_reactor *reactor) {
+    reactor->dispatching = 0;
+    reactor->should_exit = 0;
+    for (size_t i = 0; i < T503_REACTOR_MAX_HANDLERS; i++) {
+        reactor->handlers[i].fd = -1;
+        reactor->handlers[i].cb = NULL;
+        reactor->handlers[i].user_data = NULL;
+        reactor->handlers[i].stale = 0;
+        reactor->handlers[i].is_timer = 0;
+    }
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+void t503_reactor_exit(struct t503_reactor *reactor) {
+    for (size_t i = 0; i < T503_REACTOR_MAX_HANDLERS; i++) {
+        struct t503_reactor_handler *handler = &reactor->handlers[i];
+        if (handler->fd != -1 && handler->is_timer) close(handler->fd);
+        handler->fd = -1;
+    }
+    if (reactor->epoll_fd != -1) close(reactor->epoll_fd);
+    reactor->epoll_fd = -1;
+}
+
+int t503_reactor_add(struct t503_reactor *reactor, int fd, uint32_t events,
+                     t503_reactor_cb cb, void *user_data) {
+    assert(fd >= 0);
+    assert(!t503_reactor_find(reactor, fd));
+
+    struct t503_reactor_handler *handler = NULL;
+    for (size_t i = 0; i < T503_REACTOR_MAX_HANDLERS; i++) {
+        if (reactor->handlers[i].fd == -1 && !reactor->handlers[i].stale) {
+            handler = &reactor->handlers[i];
+            break;
+        }
+    }
+    if (!handler) {
+        fprintf(stderr, "Too many reactor handlers\n");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    handler->fd = fd;
+    handler->cb = cb;
+    handler->user_data = user_data;
+    handler->is_timer = 0;
+    return 0;
+}
+
+int t503_reactor_modify(struct t503_reactor *reactor, int fd, uint32_t events) {
+    struct t503_reactor_handler *handler = t503_reactor_find(reactor, fd);
+    if (!handler) return -1;
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    return epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void t503_reactor_remove(struct t503_reactor *reactor, int fd) {
+    struct t503_reactor_handler *handler = t503_reactor_find(reactor, fd);
+    if (!handler) return;
+
+    /* The fd may already be closed, in which case epoll has dropped it */
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    handler->fd = -1;
+    handler->cb = NULL;
+    handler->user_data = NULL;
+    handler->stale = reactor->dispatching;
+}
+
+int t503_reactor_arm_timer(int timer_fd, uint64_t value_ns, uint64_t period_ns) {
+    struct itimerspec its;
+    its.it_value.tv_sec = value_ns / 1000000000ull;
+    its.it_value.tv_nsec = value_ns % 1000000000ull;
+    its.it_interval.tv_sec = period_ns / 1000000000ull;
+    its.it_interval.tv_nsec = period_ns % 1000000000ull;
+    return timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+int t503_reactor_add_timer(struct t503_reactor *reactor, uint64_t period_ns,
+                           t503_reactor_cb cb, void *user_data) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+    if (period_ns && t503_reactor_arm_timer(fd, period_ns, period_ns)) goto error;
+    if (t503_reactor_add(reactor, fd, EPOLLIN, cb, user_data)) goto error;
+
+    t503_reactor_find(reactor, fd)->is_timer = 1;
+    return fd;
+
+error:
+    close(fd);
+    return -1;
+}
+
+void t503_reactor_remove_timer(struct t503_reactor *reactor, int timer_fd) {
+    t503_reactor_remove(reactor, timer_fd);
+    close(timer_fd);
+}
+
+int t503_reactor_run_once(struct t503_reactor *reactor, int timeout_ms) {
+    struct epoll_event events[T503_REACTOR_MAX_EVENTS];
+
+    int n = epoll_wait(reactor->epoll_fd, events, T503_REACTOR_MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno == EINTR) return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+
+    reactor->dispatching = 1;
+    for (int i = 0; i < n; i++) {
+        struct t503_reactor_handler *handler = events[i].data.ptr;
+        /* Removed by an earlier callback of this batch */
+        if (handler->fd == -1) continue;
+
+        if (handler->is_timer) {
+            uint64_t expirations;
+            if (read(handler->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+        }
+        handler->cb(handler->user_data, events[i].events);
+    }
+    reactor->dispatching = 0;
+
+    for (size_t i = 0; i < T503_REACTOR_MAX_HANDLERS; i++) {
+        reactor->handlers[i].stale = 0;
+    }
+    return n;
+}
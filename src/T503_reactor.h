@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+
+/* Enough for the context and every tablet it can serve, checked against them in T503.h */
+#define T503_REACTOR_MAX_HANDLERS 80
+#define T503_REACTOR_MAX_EVENTS 16
+
+/* Called with the epoll events that fired on the fd */
+typedef void (*t503_reactor_cb)(void *user_data, uint32_t events);
+
+struct t503_reactor_handler {
+    int fd;
+    t503_reactor_cb cb;
+    void *user_data;
+    /* Removed while a batch is dispatched, not reusable until the batch is done */
+    uint8_t stale;
+    /* Timer handlers consume the expiration count before calling cb */
+    uint8_t is_timer;
+};
+
+struct t503_reactor {
+    int epoll_fd;
+    int dispatching;
+    volatile int should_exit;
+    struct t503_reactor_handler handlers[T503_REACTOR_MAX_HANDLERS];
+};
+
+int t503_reactor_init(struct t503_reactor *);
+void t503_reactor_exit(struct t503_reactor *);
+
+int t503_reactor_add(struct t503_reactor *, int fd, uint32_t events,
+                     t503_reactor_cb cb, void *user_data);
+int t503_reactor_modify(struct t503_reactor *, int fd, uint32_t events);
+void t503_reactor_remove(struct t503_reactor *, int fd);
+
+/* Periodic timer backed by a timerfd, returns the fd or -1 */
+int t503_reactor_add_timer(struct t503_reactor *, uint64_t period_ns,
+                           t503_reactor_cb cb, void *user_data);
+/* Re-arm a timer as one-shot (period_ns == 0) or periodic, value_ns == 0 disarms it */
+int t503_reactor_arm_timer(int timer_fd, uint64_t value_ns, uint64_t period_ns);
+void t503_reactor_remove_timer(struct t503_reactor *, int timer_fd);
+
+/* Wait at most timeout_ms (-1 for ever) and dispatch ready handlers.
+ * Returns the number of dispatched events, 0 on timeout, -1 on error. */
+int t503_reactor_run_once(struct t503_reactor *, int timeout_ms);
@@ -0,0 +1,116 @@
+#include "T503_record.h"
+#include "T503_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static int t503_record_check_header(struct t503_record_header const *header) {
+    if (memcmp(header->magic, T503_RECORD_MAGIC, sizeof(header->magic))
+        || header->version != T503_RECORD_VERSION
+        || header->record_size != sizeof(struct t503_mock_report)) {
+        errorf("Not a T503 capture file, or one written by another version\n");
+        return -1;
+    }
+    return 0;
+}
+
+FILE *t503_record_open(const char *path, char *buffer, size_t size) {
+    struct t503_record_header header;
+
+    FILE *file = fopen(path, "a+b");
+    if (!file) goto error_fopen;
+    setvbuf(file, buffer, _IOFBF, size);
+
+    if (fseek(file, 0, SEEK_END)) goto error_header;
+    if (ftell(file) == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, T503_RECORD_MAGIC, sizeof(header.magic));
+        header.version = T503_RECORD_VERSION;
+        header.record_size = sizeof(struct t503_mock_report);
+        if (fwrite(&header, sizeof(header), 1, file) != 1) goto error_header;
+    } else {
+        rewind(file);
+        if (fread(&header, sizeof(header), 1, file) != 1) goto error_header;
+        if (t503_record_check_header(&header)) goto error_header;
+        /* Appending ignores the file position, this only resets the stream for writing */
+        if (fseek(file, 0, SEEK_END)) goto error_header;
+    }
+    return file;
+
+error_header:
+    fclose(file);
+    errorf("Cannot record to %s\n", path);
+    return NULL;
+error_fopen:
+    errorf("Cannot record to %s: %s\n", path, strerror(errno));
+    return NULL;
+}
+
+void t503_record_write(FILE *file, size_t device, size_t endpoint, const uint8_t *data, int length,
+                       uint64_t timestamp_ns) {
+    struct t503_mock_report record;
+    memset(&record, 0, sizeof(record));
+    record.timestamp_ns = timestamp_ns;
+    record.endpoint = endpoint;
+    record.device = device;
+    record.length = length < T503_IO_BUFFER_SIZE ? length : T503_IO_BUFFER_SIZE;
+    memcpy(record.data, data, record.length);
+    fwrite(&record, sizeof(record), 1, file);
+}
+
+void t503_record_close(FILE *file) {
+    if (fclose(file)) errorf("Error while closing the capture file: %s\n", strerror(errno));
+}
+
+int t503_replay_open(struct t503_replay *replay, const char *path) {
+    struct stat sb;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) goto error_open;
+    if (fstat(fd, &sb)) goto error_fstat;
+    if ((size_t)sb.st_size < sizeof(struct t503_record_header)) {
+        errno = EINVAL;
+        goto error_fstat;
+    }
+
+    replay->map_size = sb.st_size;
+    replay->map = mmap(NULL, replay->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (replay->map == MAP_FAILED) goto error_fstat;
+    close(fd);
+
+    if (t503_record_check_header((struct t503_record_header const *)replay->map)) {
+        munmap(replay->map, replay->map_size);
+        return -1;
+    }
+    replay->reports = (const struct t503_mock_report *)
+        ((const uint8_t *)replay->map + sizeof(struct t503_record_header));
+    replay->n_reports = (replay->map_size - sizeof(struct t503_record_header))
+                        / sizeof(struct t503_mock_report);
+
+    /* Checked once here, the decoders trust the length and the endpoint of every report */
+    for (size_t i = 0; i < replay->n_reports; i++) {
+        const struct t503_mock_report *report = &replay->reports[i];
+        if (report->length <= T503_IO_BUFFER_SIZE && report->endpoint < T503_N_ENDPOINTS) continue;
+        errorf("Cannot replay %s: record %zu has %u bytes on endpoint %u\n", path, i, report->length,
+            report->endpoint);
+        munmap(replay->map, replay->map_size);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+
+error_fstat:
+    close(fd);
+error_open:
+    errorf("Cannot replay %s: %s\n", path, strerror(errno));
+    return -1;
+}
+
+void t503_replay_close(struct t503_replay *replay) {
+    munmap(replay->map, replay->map_size);
+    replay->map = NULL;
+}
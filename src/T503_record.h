@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "T503.h"
+
+/*
+ * Capture file: a header followed by struct t503_mock_report records, all in host byte order.
+ * Timestamps are CLOCK_MONOTONIC nanoseconds taken when the report was received. The reports of every tablet
+ * go to the same file, each one with the index of its device so that a replay gives it back to the same one.
+ */
+#define T503_RECORD_MAGIC "T503REC"
+#define T503_RECORD_VERSION 1
+
+struct t503_record_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct t503_replay {
+    void *map;
+    size_t map_size;
+    const struct t503_mock_report *reports;
+    size_t n_reports;
+};
+
+/* Open for appending through the given buffer, the header is written when the file is empty */
+FILE *t503_record_open(const char *path, char *buffer, size_t size);
+void t503_record_write(FILE *, size_t device, size_t endpoint, const uint8_t *data, int length, uint64_t timestamp_ns);
+void t503_record_close(FILE *);
+
+int t503_replay_open(struct t503_replay *, const char *path);
+void t503_replay_close(struct t503_replay *);
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include "T503_rt.h"
+#include "T503_log.h"
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct t503_rt_probe {
+    struct t503_context *ctx;
+    int timer_fd;
+    uint64_t period_ns;
+    uint64_t due_ns;
+};
+
+struct t503_rt_thread {
+    struct t503_context *ctx;
+    int retn;
+};
+
+static void probe_cb(void *, uint32_t);
+
+
+static int t503_rt_arm_probe(struct t503_rt_probe *probe) {
+    probe->due_ns = t503_now_ns() + probe->period_ns;
+    return t503_reactor_arm_timer(probe->timer_fd, probe->period_ns, 0);
+}
+
+/* The delay between the expiration of the timer and its callback is how late a report would be handled */
+static void probe_cb(void *user_data, uint32_t events) {
+    struct t503_rt_probe *probe = (struct t503_rt_probe *)user_data;
+    uint64_t now = t503_now_ns();
+    t503_histogram_add(&probe->ctx->wakeup, now > probe->due_ns ? now - probe->due_ns : 0);
+    t503_rt_arm_probe(probe);
+}
+
+static void t503_rt_lock_memory(void) {
+    /* Keep freed memory in the process, giving it back would fault it in again later */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        errorf("Warning: cannot lock memory, page faults may delay reports: %s\n", strerror(errno));
+    }
+}
+
+static void __attribute__((noinline)) t503_rt_prefault_stack(void) {
+    volatile uint8_t stack[T503_RT_STACK_SIZE / 2];
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < sizeof(stack); i += page_size) stack[i] = 0;
+}
+
+static void *t503_rt_thread(void *user_data) {
+    struct t503_rt_thread *thread = (struct t503_rt_thread *)user_data;
+    t503_rt_prefault_stack();
+    thread->retn = t503_loop(thread->ctx);
+    return NULL;
+}
+
+static int t503_rt_start_thread(pthread_t *pthread, struct t503_rt_thread *thread, struct t503_rt_options const *opts) {
+    pthread_attr_t attr;
+    int retn;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, T503_RT_STACK_SIZE);
+    if (opts->priority) {
+        struct sched_param param = { .sched_priority = opts->priority };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    if (opts->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(opts->cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+
+    retn = pthread_create(pthread, &attr, t503_rt_thread, thread);
+    pthread_attr_destroy(&attr);
+    return retn;
+}
+
+int t503_rt_run(struct t503_context *ctx, struct t503_rt_options const *opts) {
+    struct t503_rt_probe probe = { ctx, -1, opts->probe_period_ns, 0 };
+    struct t503_rt_thread thread = { ctx, -1 };
+    pthread_t pthread;
+
+    if (opts->probe_period_ns) {
+        probe.timer_fd = t503_reactor_add_timer(&ctx->reactor, 0, probe_cb, &probe);
+        if (probe.timer_fd == -1 || t503_rt_arm_probe(&probe)) {
+            errorf("Cannot start the wakeup latency probe\n");
+        }
+    }
+
+    if (!opts->priority && opts->cpu < 0) {
+        thread.retn = t503_loop(ctx);
+        goto done;
+    }
+
+    if (opts->priority) t503_rt_lock_memory();
+
+    int retn = t503_rt_start_thread(&pthread, &thread, opts);
+    if (retn) {
+        errorf("Cannot start the real-time event loop thread: %s\n", strerror(retn));
+        if (retn == EPERM) errorf("SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO of at least %d\n", opts->priority);
+        goto done;
+    }
+    pthread_join(pthread, NULL);
+
+done:
+    if (probe.timer_fd != -1) t503_reactor_remove_timer(&ctx->reactor, probe.timer_fd);
+    return thread.retn;
+}
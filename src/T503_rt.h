@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+#include "T503.h"
+
+/* Stack of the event loop thread, locked and prefaulted in real-time mode */
+#define T503_RT_STACK_SIZE (256 * 1024)
+
+struct t503_rt_options {
+    /* SCHED_FIFO priority of the event loop thread, 0 keeps the normal scheduler */
+    int priority;
+    /* CPU the event loop thread is pinned to, -1 for any */
+    int cpu;
+    /* Period of the timer measuring the wakeup latency of the loop, 0 disables it */
+    uint64_t probe_period_ns;
+};
+
+/*
+ * Runs t503_loop(), on a dedicated thread when a priority or a CPU is given.
+ * With a priority, all memory is locked first so that the loop never waits for a page fault.
+ */
+int t503_rt_run(struct t503_context *, struct t503_rt_options const *);
@@ -0,0 +1,132 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Shared memory ring of decoded samples, written by the daemon and mapped by any number of readers.
+ * Each slot works as a seqlock: the daemon never waits for a reader, a reader that falls more than
+ * T503_SHM_SLOTS samples behind loses the oldest ones and counts them.
+ *
+ * A client connects to the export socket and receives, along with a struct t503_shm_hello, the memfd
+ * of the ring, which only the daemon can map writable, and a memfd holding a struct t503_shm_flag and
+ * an eventfd of its own. While its waiting flag is set, the daemon writes to the eventfd after every
+ * sample, otherwise publishing costs no system call.
+ */
+#define T503_SHM_MAGIC 0x33303554u
+#define T503_SHM_VERSION 2
+/* A power of two */
+#define T503_SHM_SLOTS 4096
+#define T503_SHM_MAX_READERS 8
+#define T503_SHM_CACHE_LINE 64
+
+struct t503_shm_sample {
+    /* Odd while the slot is written, then 2 * (index of the sample + 1) */
+    uint64_t sequence;
+    /* CLOCK_MONOTONIC time the report was received */
+    uint64_t timestamp_ns;
+    /* Raw device values, as in struct t503_report */
+    uint16_t x;
+    uint16_t y;
+    uint16_t pressure;
+    uint8_t buttons;
+    uint8_t buttons_valid;
+    uint8_t pen;
+    uint8_t kind;
+    uint8_t device;
+    uint8_t reserved[5];
+};
+
+struct t503_shm_ring {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t sample_size;
+
+    /* Samples published so far, only written by the daemon */
+    uint64_t head __attribute__((aligned(T503_SHM_CACHE_LINE)));
+
+    struct t503_shm_sample samples[T503_SHM_SLOTS] __attribute__((aligned(T503_SHM_CACHE_LINE)));
+};
+
+/* Shared by the daemon and a single reader, so that a reader cannot write into the ring of the others */
+struct t503_shm_flag {
+    /* Set by the reader before it sleeps on its eventfd */
+    uint32_t waiting;
+};
+
+/* Sent with the file descriptors */
+struct t503_shm_hello {
+    uint32_t version;
+    /* Index of this reader in the daemon */
+    uint32_t reader;
+};
+
+struct t503_shm_reader {
+    struct t503_shm_ring const *ring;
+    uint64_t next;
+    uint64_t lost;
+    /* Times the reader fell more than the ring behind */
+    uint64_t overruns;
+};
+
+static inline void t503_shm_init(struct t503_shm_ring *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->magic = T503_SHM_MAGIC;
+    ring->version = T503_SHM_VERSION;
+    ring->n_slots = T503_SHM_SLOTS;
+    ring->sample_size = sizeof(struct t503_shm_sample);
+}
+
+/* Single producer, the sequence of the sample is filled in */
+static inline void t503_shm_write(struct t503_shm_ring *ring, struct t503_shm_sample const *sample) {
+    uint64_t index = ring->head;
+    struct t503_shm_sample *slot = &ring->samples[index & (T503_SHM_SLOTS - 1)];
+
+    __atomic_store_n(&slot->sequence, 2 * index + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + sizeof(slot->sequence), (const char *)sample + sizeof(sample->sequence),
+           sizeof(*slot) - sizeof(slot->sequence));
+    __atomic_store_n(&slot->sequence, 2 * index + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELEASE);
+}
+
+/* Starts at the next sample to be published */
+static inline void t503_shm_reader_init(struct t503_shm_reader *reader, struct t503_shm_ring const *ring) {
+    reader->ring = ring;
+    reader->next = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    reader->lost = 0;
+    reader->overruns = 0;
+}
+
+static inline int t503_shm_empty(struct t503_shm_reader const *reader) {
+    return __atomic_load_n(&reader->ring->head, __ATOMIC_ACQUIRE) == reader->next;
+}
+
+/* Copies the next sample out of the ring, returns 0 when there is none yet */
+static inline int t503_shm_read(struct t503_shm_reader *reader, struct t503_shm_sample *sample) {
+    struct t503_shm_ring const *ring = reader->ring;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head == reader->next) return 0;
+        if (head - reader->next > T503_SHM_SLOTS) {
+            reader->lost += head - reader->next - T503_SHM_SLOTS;
+            reader->overruns++;
+            reader->next = head - T503_SHM_SLOTS;
+        }
+
+        struct t503_shm_sample const *slot = &ring->samples[reader->next & (T503_SHM_SLOTS - 1)];
+        uint64_t expected = 2 * reader->next + 2;
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        memcpy(sample, slot, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (sequence == expected && __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == expected) {
+            reader->next++;
+            return 1;
+        }
+        /* The daemon went round the ring while the slot was copied */
+        reader->lost++;
+        reader->next++;
+    }
+}
@@ -0,0 +1,97 @@
+#include "T503_stats.h"
+#include <string.h>
+
+
+static uint64_t t503_histogram_upper(size_t bucket) {
+    if (bucket < (1u << T503_HISTOGRAM_SUB_BITS)) return bucket;
+    unsigned int exponent = (bucket >> T503_HISTOGRAM_SUB_BITS) + T503_HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1u << T503_HISTOGRAM_SUB_BITS) - 1);
+    uint64_t lower = ((1ull << T503_HISTOGRAM_SUB_BITS) | sub) << (exponent - T503_HISTOGRAM_SUB_BITS);
+    return lower + (1ull << (exponent - T503_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+uint64_t t503_histogram_percentile(struct t503_histogram const *histogram, double fraction) {
+    uint64_t count = t503_load(&histogram->count);
+    if (!count) return 0;
+
+    /* Rank of the value, counted from 1 */
+    uint64_t rank = (uint64_t)(fraction * count);
+    if (rank < count) rank++;
+    uint64_t max = t503_load(&histogram->max);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < T503_HISTOGRAM_BUCKETS; i++) {
+        seen += t503_load(&histogram->buckets[i]);
+        if (seen >= rank) {
+            uint64_t upper = t503_histogram_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void t503_stats_reset(struct t503_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+void t503_stats_report(struct t503_stats *stats, size_t endpoint, uint64_t received_ns) {
+    struct t503_gap_stats *gap = &stats->gaps[endpoint];
+    t503_counter_inc(&stats->reports[endpoint]);
+
+    if (gap->last_ns) {
+        uint64_t delta = received_ns - gap->last_ns;
+        if (delta >= T503_GAP_IDLE_NS) {
+            t503_counter_inc(&gap->idle);
+        } else {
+            t503_counter_inc(&gap->count);
+            __atomic_store_n(&gap->sum_ns, gap->sum_ns + delta, __ATOMIC_RELAXED);
+            if (delta > gap->max_ns) __atomic_store_n(&gap->max_ns, delta, __ATOMIC_RELAXED);
+        }
+    }
+    gap->last_ns = received_ns;
+}
+
+void t503_histogram_print(struct t503_histogram const *histogram, const char *name, FILE *file) {
+    fprintf(file, "%s: %llu samples, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+        name,
+        (unsigned long long)t503_load(&histogram->count),
+        t503_histogram_percentile(histogram, 0.5) / 1000.0,
+        t503_histogram_percentile(histogram, 0.99) / 1000.0,
+        t503_histogram_percentile(histogram, 0.999) / 1000.0,
+        t503_load(&histogram->max) / 1000.0);
+}
+
+void t503_stats_print(struct t503_stats const *stats, FILE *file) {
+    for (size_t i = 0; i < T503_STATS_N_ENDPOINTS; i++) {
+        struct t503_gap_stats const *gap = &stats->gaps[i];
+        uint64_t count = t503_load(&gap->count);
+        fprintf(file, "endpoint %zu: %llu reports, %llu gaps, mean %llu us, max %llu us, %llu idle\n",
+            i,
+            (unsigned long long)t503_load(&stats->reports[i]),
+            (unsigned long long)count,
+            (unsigned long long)(count ? t503_load(&gap->sum_ns) / count / 1000 : 0),
+            (unsigned long long)(t503_load(&gap->max_ns) / 1000),
+            (unsigned long long)t503_load(&gap->idle));
+    }
+    fprintf(file, "unknown sequences: %llu\n", (unsigned long long)t503_load(&stats->unknown));
+    fprintf(file, "redundant pen reports: %llu events and %llu writes saved\n",
+        (unsigned long long)t503_load(&stats->events_saved),
+        (unsigned long long)t503_load(&stats->writes_saved));
+
+    uint64_t n_errors = 0;
+    for (size_t i = 0; i < T503_TRANSFER_N_ERRORS; i++) n_errors += t503_load(&stats->transfer_errors[i]);
+    if (n_errors) {
+        fprintf(file, "transfer errors: %llu error, %llu timed out, %llu stall, %llu overflow, "
+            "%llu no device, %llu submit, %llu recoveries\n",
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_ERROR]),
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_TIMED_OUT]),
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_STALL]),
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_OVERFLOW]),
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_NO_DEVICE]),
+            (unsigned long long)t503_load(&stats->transfer_errors[T503_TRANSFER_SUBMIT]),
+            (unsigned long long)t503_load(&stats->recoveries));
+    }
+    t503_histogram_print(&stats->decode, "decode latency", file);
+    t503_histogram_print(&stats->emit, "emit latency", file);
+    t503_histogram_print(&stats->total, "total latency", file);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Endpoints counted separately, matches T503_N_ENDPOINTS */
+#define T503_STATS_N_ENDPOINTS 2
+
+/* Gaps longer than this are treated as idle time rather than inter-report gaps */
+#define T503_GAP_IDLE_NS 50000000ull
+
+/*
+ * Log-scale histogram of nanoseconds: values below 2^T503_HISTOGRAM_SUB_BITS get a bucket each,
+ * every larger power of two is split into 2^T503_HISTOGRAM_SUB_BITS buckets, which bounds the
+ * relative error of a percentile to 1/2^T503_HISTOGRAM_SUB_BITS.
+ */
+#define T503_HISTOGRAM_SUB_BITS 3
+#define T503_HISTOGRAM_BUCKETS ((64 - T503_HISTOGRAM_SUB_BITS + 1) << T503_HISTOGRAM_SUB_BITS)
+
+/*
+ * Only the event loop updates the statistics, so the counters need no lock, they are stored
+ * with relaxed atomics so that other threads can read consistent values at any time.
+ */
+struct t503_histogram {
+    uint64_t buckets[T503_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+struct t503_gap_stats {
+    uint64_t last_ns;
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t idle;
+};
+
+/* Failures of USB transfers, by class */
+enum t503_transfer_error {
+    T503_TRANSFER_ERROR,
+    T503_TRANSFER_TIMED_OUT,
+    T503_TRANSFER_STALL,
+    T503_TRANSFER_OVERFLOW,
+    T503_TRANSFER_NO_DEVICE,
+    /* A transfer that could not be resubmitted */
+    T503_TRANSFER_SUBMIT,
+    T503_TRANSFER_N_ERRORS,
+};
+
+struct t503_stats {
+    uint64_t reports[T503_STATS_N_ENDPOINTS];
+    uint64_t unknown;
+    struct t503_gap_stats gaps[T503_STATS_N_ENDPOINTS];
+    uint64_t transfer_errors[T503_TRANSFER_N_ERRORS];
+    /* Endpoints back to all transfers in flight after failures */
+    uint64_t recoveries;
+    /* Events and writes that redundant or merged pen reports did not cost */
+    uint64_t events_saved;
+    uint64_t writes_saved;
+
+    /* Reception of a report to decoded, decoded to the last write of its frame, and both */
+    struct t503_histogram decode;
+    struct t503_histogram emit;
+    struct t503_histogram total;
+};
+
+static inline void t503_counter_inc(uint64_t *counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t t503_load(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static inline size_t t503_histogram_bucket(uint64_t value) {
+    if (value < (1u << T503_HISTOGRAM_SUB_BITS)) return value;
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    size_t sub = (value >> (exponent - T503_HISTOGRAM_SUB_BITS)) & ((1u << T503_HISTOGRAM_SUB_BITS) - 1);
+    return ((exponent - T503_HISTOGRAM_SUB_BITS + 1) << T503_HISTOGRAM_SUB_BITS) + sub;
+}
+
+static inline void t503_histogram_add(struct t503_histogram *histogram, uint64_t value) {
+    t503_counter_inc(&histogram->buckets[t503_histogram_bucket(value)]);
+    t503_counter_inc(&histogram->count);
+    if (value > histogram->max) __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+/* Upper bound of the bucket holding the given fraction of the values, 0 when empty */
+uint64_t t503_histogram_percentile(struct t503_histogram const *, double fraction);
+
+void t503_histogram_print(struct t503_histogram const *, const char *name, FILE *);
+
+void t503_stats_reset(struct t503_stats *);
+void t503_stats_report(struct t503_stats *, size_t endpoint, uint64_t received_ns);
+void t503_stats_print(struct t503_stats const *, FILE *);
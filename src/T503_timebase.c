@@ -0,0 +1,37 @@
+#include "T503_timebase.h"
+
+
+uint64_t t503_timebase_update(struct t503_timebase *timebase, uint64_t received_ns) {
+    uint64_t last = timebase->last_ns;
+
+    if (!last || received_ns <= last || received_ns - last > T503_TIMEBASE_RESET_NS) {
+        /* The period is kept over pauses, the tablet rate does not change */
+        timebase->last_ns = received_ns;
+        return received_ns;
+    }
+    if (timebase->n_seeds < T503_TIMEBASE_SEEDS) {
+        if (received_ns - last > timebase->period_ns) timebase->period_ns = received_ns - last;
+        timebase->n_seeds++;
+        timebase->last_ns = received_ns;
+        return received_ns;
+    }
+
+    /* Reports lost on the way move the prediction by whole periods */
+    uint64_t period = timebase->period_ns;
+    uint64_t n_periods = (received_ns - last + period / 2) / period;
+    if (!n_periods) n_periods = 1;
+    uint64_t predicted = last + n_periods * period;
+
+    uint64_t now;
+    if (received_ns <= predicted) {
+        now = received_ns;
+    } else {
+        now = predicted + (received_ns - predicted) / T503_TIMEBASE_GAIN;
+    }
+    if (now <= last) now = last + 1;
+
+    int64_t error = (int64_t)((now - last) / n_periods) - (int64_t)period;
+    timebase->period_ns = period + error / T503_TIMEBASE_PERIOD_GAIN;
+    timebase->last_ns = now;
+    return now;
+}
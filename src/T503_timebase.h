@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Time of the reports of one endpoint as the tablet sent them. The tablet reports at a steady
+ * rate while the host adds a varying delay to each completion, so the time of a report is
+ * predicted from the previous one and the period, and only pulled towards the completion time.
+ * A completion earlier than predicted had less delay, it is trusted at once.
+ */
+struct t503_timebase {
+    /* Timebase time of the last report, 0 before the first one */
+    uint64_t last_ns;
+    uint64_t period_ns;
+    /* Intervals the period was seeded from */
+    uint32_t n_seeds;
+};
+
+/* Reports further apart start over from the completion time */
+#define T503_TIMEBASE_RESET_NS 50000000ull
+/* Fraction of the completion delay taken over per report, and of the period error */
+#define T503_TIMEBASE_GAIN 8
+#define T503_TIMEBASE_PERIOD_GAIN 32
+/*
+ * The period starts as the longest of the first intervals: one that is too long shrinks back,
+ * one that is too short could settle on a fraction of the real period.
+ */
+#define T503_TIMEBASE_SEEDS 4
+
+static inline void t503_timebase_reset(struct t503_timebase *timebase) {
+    timebase->last_ns = 0;
+    timebase->period_ns = 0;
+    timebase->n_seeds = 0;
+}
+
+/* Timebase time of a report completed at received_ns, never later than it */
+uint64_t t503_timebase_update(struct t503_timebase *, uint64_t received_ns);
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+struct t503_context;
+struct t503_device;
+struct t503_options;
+
+/* Source of raw reports, adds its devices and hands every report to t503_handle_report() */
+struct t503_source_ops {
+    const char *name;
+    int (*init)(struct t503_context *, struct t503_options const *);
+    void (*exit)(struct t503_context *);
+    /* Start delivering reports when the loop starts, stop and drain in-flight I/O when it ends */
+    int (*start)(struct t503_context *);
+    void (*stop)(struct t503_context *);
+    /* Timeout of the next reactor wait in milliseconds, may be NULL */
+    int (*timeout_ms)(struct t503_context *);
+};
+
+/* Output of decoded events, every write is the frame of one node of a device ending with SYN_REPORT */
+struct t503_sink_ops {
+    const char *name;
+    int (*init)(struct t503_context *, struct t503_options const *);
+    void (*exit)(struct t503_context *);
+    /* Output of one device, opened when the device is added and closed at exit */
+    int (*open)(struct t503_device *);
+    void (*close)(struct t503_device *);
+    /* node is an enum t503_node */
+    int (*write)(struct t503_device *, size_t node, const struct input_event *, size_t);
+};
+
+extern const struct t503_source_ops t503_source_libusb;
+extern const struct t503_source_ops t503_source_hidraw;
+extern const struct t503_source_ops t503_source_mock;
+
+extern const struct t503_sink_ops t503_sink_uinput;
+extern const struct t503_sink_ops t503_sink_capture;
@@ -0,0 +1,145 @@
+#include "T503.h"
+#include "T503_log.h"
+#include <assert.h>
+#include <unistd.h>
+
+
+static int t503_init_libevdev(struct t503_context *, struct t503_options const *);
+static void t503_exit_libevdev(struct t503_context *);
+static int t503_open_libevdev(struct t503_device *);
+static void t503_close_libevdev(struct t503_device *);
+static int t503_write_libevdev(struct t503_device *, size_t, const struct input_event *, size_t);
+
+const struct t503_sink_ops t503_sink_uinput = {
+    "uinput",
+    t503_init_libevdev,
+    t503_exit_libevdev,
+    t503_open_libevdev,
+    t503_close_libevdev,
+    t503_write_libevdev,
+};
+
+
+/* Every device gets its own pen and pad uinput devices, created when it is added */
+static int t503_init_libevdev(struct t503_context *ctx, struct t503_options const *opts) {
+    return 0;
+}
+
+static void t503_exit_libevdev(struct t503_context *ctx) {
+}
+
+static void t503_close_libevdev(struct t503_device *device) {
+    for (size_t node = 0; node < T503_N_NODES; node++) {
+        if (device->libevdev_uidev[node]) libevdev_uinput_destroy(device->libevdev_uidev[node]);
+        if (device->libevdev_dev[node]) libevdev_free(device->libevdev_dev[node]);
+        device->libevdev_uidev[node] = NULL;
+        device->libevdev_dev[node] = NULL;
+    }
+}
+
+/* Axes, proximity, touch and the stylus buttons, tagged as an indirect tablet */
+static int t503_libevdev_pen(struct t503_device *device, struct libevdev *dev) {
+    int retn;
+
+    retn = libevdev_enable_property(dev, INPUT_PROP_POINTER);
+    if (retn == -1) return -1;
+
+    retn = libevdev_enable_event_type(dev, EV_ABS);
+    if (retn == -1) return -1;
+    /* The ranges of the mapping at startup, a reload cannot change them */
+    struct t503_transform const *transform = &device->transform;
+    struct input_absinfo absinfo_x = {
+        0, 0, transform->max[0], 0, 0, transform->resolution[0]
+    };
+    struct input_absinfo absinfo_y = {
+        0, 0, transform->max[1], 0, 0, transform->resolution[1]
+    };
+    struct input_absinfo absinfo_p = {
+        0, 0, T503_MAX_PRESSURE, 0, 0, 0
+    };
+    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_X, &absinfo_x);
+    if (retn == -1) return -1;
+    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_Y, &absinfo_y);
+    if (retn == -1) return -1;
+    retn = libevdev_enable_event_code(dev, EV_ABS, ABS_PRESSURE, &absinfo_p);
+    if (retn == -1) return -1;
+
+    retn = libevdev_enable_event_type(dev, EV_KEY);
+    if (retn == -1) return -1;
+    /* BTN_TOOL_PEN makes this a pen to libinput, BTN_STYLUS is always there as on most pens */
+    static const unsigned int pen_keys[] = { BTN_TOOL_PEN, BTN_TOUCH, BTN_STYLUS };
+    for (size_t i = 0; i < T503_COUNT_OF(pen_keys); i++) {
+        retn = libevdev_enable_event_code(dev, EV_KEY, pen_keys[i], NULL);
+        if (retn == -1) return -1;
+    }
+    return 0;
+}
+
+/* Both nodes send the time the tablet sent each frame, the kernel stamps the events when they are written */
+static int t503_libevdev_node(struct t503_device *device, size_t node) {
+    struct libevdev *dev = libevdev_new();
+    if (!dev) return -1;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s %s", device->profile->name, node == T503_NODE_PEN ? "Pen" : "Pad");
+    libevdev_set_name(dev, name);
+    libevdev_set_id_bustype(dev, BUS_USB);
+    libevdev_set_id_vendor(dev, device->profile->vendor);
+    libevdev_set_id_product(dev, device->profile->product);
+
+    int retn = node == T503_NODE_PEN ? t503_libevdev_pen(device, dev) : 0;
+    if (retn == -1) goto error;
+
+    retn = libevdev_enable_event_type(dev, EV_MSC);
+    if (retn == -1) goto error;
+    retn = libevdev_enable_event_code(dev, EV_MSC, MSC_TIMESTAMP, NULL);
+    if (retn == -1) goto error;
+
+    /* The keys of the mapping, each one on the node that sends it */
+    for (unsigned int key = 0; key < KEY_CNT; key++) {
+        if (!(device->ctx->key_caps[key / 8] & (1u << (key % 8))) || t503_key_node(key) != node) continue;
+        retn = libevdev_enable_event_code(dev, EV_KEY, key, NULL);
+        if (retn == -1) goto error;
+    }
+
+    struct libevdev_uinput *uidev;
+    retn = libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
+    if (retn) goto error;
+
+    device->libevdev_dev[node] = dev;
+    device->libevdev_uidev[node] = uidev;
+    return 0;
+
+error:
+    libevdev_free(dev);
+    return -1;
+}
+
+static int t503_open_libevdev(struct t503_device *device) {
+    for (size_t node = 0; node < T503_N_NODES; node++) {
+        device->libevdev_dev[node] = NULL;
+        device->libevdev_uidev[node] = NULL;
+    }
+
+    for (size_t node = 0; node < T503_N_NODES; node++) {
+        if (t503_libevdev_node(device, node)) goto error_libevdev_node;
+    }
+    return 0;
+
+error_libevdev_node:
+    t503_close_libevdev(device);
+    errorf("Initialize evdev error!\n");
+    return -1;
+}
+
+static int t503_write_libevdev(struct t503_device *device, size_t node, const struct input_event *events,
+                               size_t n_events) {
+    /* The kernel stamps each event itself, so the timestamps are left zeroed */
+    size_t size = n_events * sizeof(struct input_event);
+    ssize_t written = write(libevdev_uinput_get_fd(device->libevdev_uidev[node]), events, size);
+    if (written != (ssize_t)size) {
+        errorf("uinput write failed (%zd of %zu bytes)\n", written, size);
+        return -1;
+    }
+    return 0;
+}
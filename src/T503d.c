@@ -1,12 +1,283 @@
 #include "T503.h"
+#include "T503_record.h"
+#include "T503_alloc_guard.h"
+#include "T503_bench.h"
+#include "T503_log.h"
+#include "T503_rt.h"
+#include <getopt.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(const char *argv0) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -t, --transport libusb|hidraw  read reports through libusb (default) or hidraw\n"
+		"  -d, --device PATH              hidraw node of the first interface of the tablet, then of the second\n"
+		"  -p, --profile NAME             model of the tablet of --device and --replay, t503 by default\n"
+		"  -u, --usb-path BUS-PORT[.PORT]...\n"
+		"                                 only use the tablet plugged at this USB port, as named in\n"
+		"                                 /sys/bus/usb/devices, may be repeated\n"
+		"      --transfers N              keep N interrupt transfers in flight per endpoint, 1 to %d (default %d)\n"
+		"  -c, --config FILE              read key bindings from FILE and reload it when it changes\n"
+		"  -e, --export SOCKET            publish every decoded sample in shared memory to readers of SOCKET\n"
+		"  -r, --record FILE              append every raw report to a capture file\n"
+		"  -R, --replay FILE              feed the reports of a capture file instead of a tablet\n"
+		"      --replay-speed realtime|max\n"
+		"                                 keep the recorded timing (default) or replay at full speed\n"
+		"      --replay-loops N           replay the capture N times\n"
+		"  -s, --sink uinput|null         emit events through uinput (default) or only count them\n"
+		"  -b, --benchmark decode         time the decoder alone over the replayed reports and exit\n"
+		"  -b, --benchmark pressure       time the decoder with and without the pressure curve of --config\n"
+		"  -b, --benchmark prediction     compare the pen prediction of --config with the later reports\n"
+		"  -b, --benchmark export         time publishing the replayed reports to a shared memory ring and two readers\n"
+		"  -b, --benchmark timebase       compare the report timing of MSC_TIMESTAMP with the completion times\n"
+		"  -b, --benchmark write          time one write() per event against one per frame of the replayed reports\n"
+		"      --rt-priority N            run the event loop on a SCHED_FIFO thread of priority N\n"
+		"                                 with all memory locked\n"
+		"      --rt-cpu N                 pin the event loop thread to CPU N\n"
+		"      --jitter-probe US          measure the wakeup latency of the event loop every US microseconds\n"
+		"  -l, --log-level error|info|debug\n"
+		"                                 messages to print, from a separate thread while running\n"
+		"  -v, --verbose                  same as --log-level debug, also dumps the USB descriptors\n"
+		"      --startup-timing           print how long each step of the startup took\n"
+		"  -h, --help                     show this help\n",
+		argv0, T503_MAX_TRANSFERS, T503_N_TRANSFERS);
+}
+
+enum {
+	OPT_REPLAY_SPEED = 0x100,
+	OPT_REPLAY_LOOPS,
+	OPT_RT_PRIORITY,
+	OPT_RT_CPU,
+	OPT_JITTER_PROBE,
+	OPT_STARTUP_TIMING,
+	OPT_TRANSFERS,
+};
 
 int main(int argc, char *argv[]) {
+	static const struct option long_options[] = {
+		{ "transport", required_argument, NULL, 't' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "profile", required_argument, NULL, 'p' },
+		{ "usb-path", required_argument, NULL, 'u' },
+		{ "transfers", required_argument, NULL, OPT_TRANSFERS },
+		{ "config", required_argument, NULL, 'c' },
+		{ "export", required_argument, NULL, 'e' },
+		{ "record", required_argument, NULL, 'r' },
+		{ "replay", required_argument, NULL, 'R' },
+		{ "replay-speed", required_argument, NULL, OPT_REPLAY_SPEED },
+		{ "replay-loops", required_argument, NULL, OPT_REPLAY_LOOPS },
+		{ "sink", required_argument, NULL, 's' },
+		{ "benchmark", required_argument, NULL, 'b' },
+		{ "rt-priority", required_argument, NULL, OPT_RT_PRIORITY },
+		{ "rt-cpu", required_argument, NULL, OPT_RT_CPU },
+		{ "jitter-probe", required_argument, NULL, OPT_JITTER_PROBE },
+		{ "log-level", required_argument, NULL, 'l' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "startup-timing", no_argument, NULL, OPT_STARTUP_TIMING },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct t503_options opts = { .transport = T503_TRANSPORT_LIBUSB, .sink = T503_SINK_UINPUT };
+	struct t503_mock_source mock = { .n_loops = 1, .realtime = 1 };
+	struct t503_capture_sink capture = { .events = NULL };
+	struct t503_rt_options rt = { .priority = 0, .cpu = -1 };
+	struct t503_replay replay;
+	const char *replay_path = NULL;
+	const char *benchmark = NULL;
+	size_t n_devices = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "t:d:p:u:c:e:r:R:s:b:l:vh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			if (!strcmp(optarg, "libusb")) {
+				opts.transport = T503_TRANSPORT_LIBUSB;
+			} else if (!strcmp(optarg, "hidraw")) {
+				opts.transport = T503_TRANSPORT_HIDRAW;
+			} else {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'd':
+			if (n_devices == T503_N_ENDPOINTS) {
+				usage(argv[0]);
+				return -1;
+			}
+			opts.hidraw_paths[n_devices++] = optarg;
+			opts.transport = T503_TRANSPORT_HIDRAW;
+			break;
+		case 'p':
+			opts.profile = t503_profile_named(optarg);
+			if (!opts.profile) {
+				fprintf(stderr, "Unknown tablet %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'u':
+			if (opts.n_usb_paths == T503_MAX_DEVICES) {
+				usage(argv[0]);
+				return -1;
+			}
+			opts.usb_paths[opts.n_usb_paths++] = optarg;
+			break;
+		case OPT_TRANSFERS:
+			opts.n_transfers = strtoul(optarg, NULL, 0);
+			if (opts.n_transfers < 1 || opts.n_transfers > T503_MAX_TRANSFERS) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'c':
+			opts.config_path = optarg;
+			break;
+		case 'e':
+			opts.export_path = optarg;
+			break;
+		case 'r':
+			opts.record_path = optarg;
+			break;
+		case 'R':
+			replay_path = optarg;
+			break;
+		case OPT_REPLAY_SPEED:
+			if (!strcmp(optarg, "realtime")) {
+				mock.realtime = 1;
+			} else if (!strcmp(optarg, "max")) {
+				mock.realtime = 0;
+			} else {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case OPT_REPLAY_LOOPS:
+			mock.n_loops = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (!strcmp(optarg, "uinput")) {
+				opts.sink = T503_SINK_UINPUT;
+			} else if (!strcmp(optarg, "null")) {
+				opts.sink = T503_SINK_CAPTURE;
+				opts.capture = &capture;
+			} else {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'b':
+			if (strcmp(optarg, "decode") && strcmp(optarg, "pressure") && strcmp(optarg, "prediction")
+				&& strcmp(optarg, "export") && strcmp(optarg, "timebase") && strcmp(optarg, "write")) {
+				usage(argv[0]);
+				return -1;
+			}
+			benchmark = optarg;
+			break;
+		case OPT_RT_PRIORITY:
+			rt.priority = atoi(optarg);
+			if (rt.priority < sched_get_priority_min(SCHED_FIFO) || rt.priority > sched_get_priority_max(SCHED_FIFO)) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case OPT_RT_CPU:
+			rt.cpu = atoi(optarg);
+			break;
+		case OPT_JITTER_PROBE:
+			rt.probe_period_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'l':
+			if (!strcmp(optarg, "error")) {
+				g_t503_log_level = T503_LOG_ERROR;
+			} else if (!strcmp(optarg, "info")) {
+				g_t503_log_level = T503_LOG_INFO;
+			} else if (!strcmp(optarg, "debug")) {
+				g_t503_log_level = T503_LOG_DEBUG;
+			} else {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case 'v':
+			g_t503_log_level = T503_LOG_DEBUG;
+			break;
+		case OPT_STARTUP_TIMING:
+			opts.startup_timing = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (benchmark && !replay_path) {
+		fprintf(stderr, "--benchmark needs reports from --replay\n");
+		return -1;
+	}
+
+	if (replay_path) {
+		if (t503_replay_open(&replay, replay_path)) return -1;
+		mock.reports = replay.reports;
+		mock.n_reports = replay.n_reports;
+		opts.transport = T503_TRANSPORT_MOCK;
+		opts.mock = &mock;
+	}
 
-	struct t503_context ctx;
-	if (t503_init(&ctx)) return -1;
-	t503_loop(&ctx);
+	if (benchmark) {
+		/* The settings the benchmarks depend on are taken from --config */
+		static struct t503_config config;
+		struct t503_profile const *profile = opts.profile ? opts.profile : t503_profile_default();
+		int retn = 0;
+		if (opts.config_path) {
+			retn = t503_config_load(&config, opts.config_path);
+		} else {
+			t503_config_default(&config);
+		}
+		if (!retn && !strcmp(benchmark, "decode")) {
+			retn = t503_bench_decode(replay.reports, replay.n_reports, mock.n_loops, profile);
+		} else if (!retn && !strcmp(benchmark, "export")) {
+			retn = t503_bench_export(replay.reports, replay.n_reports, mock.n_loops, profile);
+		} else if (!retn && !strcmp(benchmark, "write")) {
+			retn = t503_bench_write(replay.reports, replay.n_reports, mock.n_loops, profile, opts.config_path);
+		} else if (!retn && !strcmp(benchmark, "timebase")) {
+			retn = t503_bench_timebase(replay.reports, replay.n_reports);
+		} else if (!retn && !strcmp(benchmark, "pressure")) {
+			retn = t503_bench_pressure(replay.reports, replay.n_reports, mock.n_loops, profile, &config);
+		} else if (!retn) {
+			retn = t503_bench_prediction(replay.reports, replay.n_reports, profile, &config);
+		}
+		t503_replay_close(&replay);
+		return retn;
+	}
+
+	t503_log_start();
+
+	/* Kept off the stack, it holds the buffers and statistics of every device */
+	static struct t503_context ctx;
+	if (t503_init(&ctx, &opts)) {
+		t503_log_stop();
+		return -1;
+	}
+	uint64_t start_ns = t503_now_ns();
+	/* The event loop may not have run at all, e.g. when the real-time thread cannot be created */
+	int retn = t503_rt_run(&ctx, &rt);
+	uint64_t elapsed_ns = t503_now_ns() - start_ns;
 	t503_exit(&ctx);
 
-	return 0;
+	t503_log_stop();
+
+	if (replay_path) {
+		unsigned long long n_reports = (unsigned long long)mock.loop * mock.n_reports + mock.position;
+		fprintf(stdout, "replayed %llu reports in %.3f ms (%.0f reports/s)\n",
+			n_reports, elapsed_ns / 1e6, elapsed_ns ? n_reports * 1e9 / elapsed_ns : 0.0);
+		t503_replay_close(&replay);
+	}
+
+	return retn ? -1 : t503_alloc_guard_report();
 
-}
\ No newline at end of file
+}
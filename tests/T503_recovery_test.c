@@ -0,0 +1,168 @@
+/* Injects transfer failures into the libusb source and checks that the recovery timers bring the endpoints back */
+#include <stdio.h>
+#include <stdlib.h>
+
+struct libusb_transfer;
+struct libusb_device_handle;
+
+/* Declared before libusb.h, so that its declarations of the replaced functions become these */
+#define libusb_submit_transfer t503_test_submit
+#define libusb_clear_halt t503_test_clear_halt
+static int t503_test_submit(struct libusb_transfer *);
+static int t503_test_clear_halt(struct libusb_device_handle *, unsigned char);
+
+#include "../src/T503_libusb.c"
+
+/* Failures still to inject, each call that fails consumes one */
+static int s_submit_failures;
+static int s_clear_halt_failures;
+static int s_n_submits;
+static int s_n_clear_halts;
+
+static struct input_event s_events[64];
+static struct t503_capture_sink s_capture;
+static struct t503_context s_ctx;
+static struct libusb_transfer s_transfers[T503_N_ENDPOINTS][T503_N_TRANSFERS];
+static uint8_t s_buffers[T503_N_ENDPOINTS][T503_N_TRANSFERS][T503_IO_BUFFER_SIZE];
+static int s_failed;
+
+#define T503_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            s_failed = 1; \
+        } \
+    } while (0)
+
+static int t503_test_submit(struct libusb_transfer *transfer) {
+    s_n_submits++;
+    if (!s_submit_failures) return 0;
+    s_submit_failures--;
+    return LIBUSB_ERROR_IO;
+}
+
+static int t503_test_clear_halt(struct libusb_device_handle *handle, unsigned char endpoint) {
+    s_n_clear_halts++;
+    if (!s_clear_halt_failures) return 0;
+    s_clear_halt_failures--;
+    return LIBUSB_ERROR_IO;
+}
+
+/* A tablet on the mock source whose transfers are all in flight, the mock itself is never started */
+static struct t503_device *t503_test_attach(void) {
+    static const struct t503_mock_report report = { .length = 8, .data = { 0x05 } };
+    struct t503_mock_source mock = { .reports = &report, .n_reports = 1, .n_loops = 1 };
+    struct t503_options opts = {
+        .transport = T503_TRANSPORT_MOCK,
+        .sink = T503_SINK_CAPTURE,
+        .mock = &mock,
+        .capture = &s_capture,
+    };
+
+    s_capture = (struct t503_capture_sink){ .events = s_events, .capacity = T503_COUNT_OF(s_events) };
+    if (t503_init(&s_ctx, &opts)) return NULL;
+
+    s_ctx.libusb_n_transfers = T503_N_TRANSFERS;
+    struct t503_device *device = &s_ctx.devices[0];
+    device->libusb_handle = (libusb_device_handle *)&s_ctx;
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        device->libusb_endpoint_addresses[i] = 0x81 + i;
+        for (size_t j = 0; j < T503_N_TRANSFERS; j++) {
+            struct libusb_transfer *transfer = &s_transfers[i][j];
+            transfer->endpoint = 0x81 + i;
+            transfer->callback = transfer_cb;
+            transfer->user_data = device;
+            transfer->buffer = s_buffers[i][j];
+            transfer->length = T503_IO_BUFFER_SIZE;
+            device->libusb_transfers[i][j] = transfer;
+        }
+        struct t503_libusb_recovery *recovery = &device->libusb_recovery[i];
+        recovery->device = device;
+        recovery->endpoint = i;
+        recovery->backoff_ns = T503_RECOVERY_MIN_NS;
+        recovery->timer_fd = t503_reactor_add_timer(&s_ctx.reactor, 0, recovery_cb, recovery);
+        if (recovery->timer_fd == -1) return NULL;
+    }
+    t503_libusb_submit_all(device);
+    return device;
+}
+
+static void t503_test_detach(struct t503_device *device) {
+    for (size_t i = 0; i < T503_N_ENDPOINTS; i++) {
+        t503_reactor_remove_timer(&s_ctx.reactor, device->libusb_recovery[i].timer_fd);
+        device->libusb_recovery[i].timer_fd = -1;
+        for (size_t j = 0; j < T503_N_TRANSFERS; j++) device->libusb_transfers[i][j] = NULL;
+    }
+    device->libusb_handle = NULL;
+    t503_exit(&s_ctx);
+}
+
+static void t503_test_complete(struct libusb_transfer *transfer, enum libusb_transfer_status status) {
+    transfer->status = status;
+    transfer->actual_length = status == LIBUSB_TRANSFER_COMPLETED ? 8 : 0;
+    transfer->callback(transfer);
+}
+
+/* Dispatches the recovery timers until nothing is parked on the endpoint, at most a few attempts */
+static void t503_test_recover(struct t503_libusb_recovery *recovery) {
+    for (int i = 0; i < 8 && recovery->n_parked; i++) t503_reactor_run_once(&s_ctx.reactor, 100);
+}
+
+/* A stalled endpoint is resubmitted only once its halt is cleared, retried with a growing backoff */
+static void t503_test_stall(void) {
+    struct t503_device *device = t503_test_attach();
+    T503_CHECK(device);
+    if (!device) return;
+    struct t503_libusb_recovery *recovery = &device->libusb_recovery[0];
+    T503_CHECK(device->libusb_inflight == T503_N_ENDPOINTS * T503_N_TRANSFERS);
+
+    t503_test_complete(device->libusb_transfers[0][0], LIBUSB_TRANSFER_STALL);
+    t503_test_complete(device->libusb_transfers[0][1], LIBUSB_TRANSFER_STALL);
+    T503_CHECK(recovery->n_parked == 2 && recovery->halted);
+    T503_CHECK(device->libusb_inflight == T503_N_ENDPOINTS * T503_N_TRANSFERS - 2);
+
+    s_n_submits = 0;
+    s_n_clear_halts = 0;
+    s_clear_halt_failures = 2;
+    t503_test_recover(recovery);
+    T503_CHECK(s_n_clear_halts == 3 && s_n_submits == 2);
+    T503_CHECK(recovery->n_parked == 0 && !recovery->halted);
+    T503_CHECK(recovery->backoff_ns == 8 * T503_RECOVERY_MIN_NS);
+    T503_CHECK(device->libusb_inflight == T503_N_ENDPOINTS * T503_N_TRANSFERS);
+    T503_CHECK(device->stats.transfer_errors[T503_TRANSFER_STALL] == 2 && device->stats.recoveries == 1);
+
+    /* The next report resets the backoff */
+    t503_test_complete(device->libusb_transfers[0][0], LIBUSB_TRANSFER_COMPLETED);
+    T503_CHECK(recovery->backoff_ns == T503_RECOVERY_MIN_NS);
+    t503_test_detach(device);
+}
+
+/* A report whose transfer cannot be resubmitted is still handled, the transfer is retried later */
+static void t503_test_submit_failure(void) {
+    struct t503_device *device = t503_test_attach();
+    T503_CHECK(device);
+    if (!device) return;
+    struct t503_libusb_recovery *recovery = &device->libusb_recovery[1];
+
+    s_submit_failures = 1;
+    t503_test_complete(device->libusb_transfers[1][0], LIBUSB_TRANSFER_COMPLETED);
+    T503_CHECK(recovery->n_parked == 1 && !recovery->halted);
+    T503_CHECK(device->stats.transfer_errors[T503_TRANSFER_SUBMIT] == 1);
+    T503_CHECK(device->stats.reports[1] == 1);
+
+    t503_test_recover(recovery);
+    T503_CHECK(recovery->n_parked == 0 && device->stats.recoveries == 1);
+    T503_CHECK(device->libusb_inflight == T503_N_ENDPOINTS * T503_N_TRANSFERS);
+
+    /* Without hotplug, a tablet that is gone stops the driver */
+    T503_CHECK(!s_ctx.reactor.should_exit);
+    t503_test_complete(device->libusb_transfers[0][0], LIBUSB_TRANSFER_NO_DEVICE);
+    T503_CHECK(s_ctx.reactor.should_exit);
+    T503_CHECK(device->libusb_recovery[0].n_parked == 0);
+    t503_test_detach(device);
+}
+
+int main(void) {
+    t503_test_stall();
+    t503_test_submit_failure();
+    return s_failed;
+}
@@ -0,0 +1,226 @@
+/* Feeds reports through the mock source or hidraw nodes and checks the events the capture sink got */
+#include "T503.h"
+#include "T503_alloc_guard.h"
+#include "T503_record.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define T503_TEST_MAX_EVENTS 1024
+
+static struct input_event s_events[T503_TEST_MAX_EVENTS];
+static struct t503_capture_sink s_capture;
+static struct t503_context s_ctx;
+static int s_failed;
+
+#define T503_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            s_failed = 1; \
+        } \
+    } while (0)
+
+/* 10moons pen report, the tip is down when pressure is not zero */
+#define T503_TEST_PEN(x, y, pressure) \
+    { .length = 8, .data = { 0x05, (pressure) ? 0xc1 : 0xc0, (y) & 0xff, (y) >> 8, (x) & 0xff, (x) >> 8, \
+                              (pressure) & 0xff, (pressure) >> 8 } }
+#define T503_TEST_PEN_LEAVE { .length = 8, .data = { 0x05, 0x00 } }
+
+/* Replays all reports in one pass of the event loop, returns the number of captured events */
+static size_t t503_test_replay(const struct t503_mock_report *reports, size_t n_reports, int coalesce) {
+    struct t503_mock_source mock = { .reports = reports, .n_reports = n_reports, .n_loops = 1 };
+    struct t503_options opts = {
+        .transport = T503_TRANSPORT_MOCK,
+        .sink = T503_SINK_CAPTURE,
+        .mock = &mock,
+        .capture = &s_capture,
+    };
+
+    s_capture = (struct t503_capture_sink){ .events = s_events, .capacity = T503_TEST_MAX_EVENTS };
+    if (t503_init(&s_ctx, &opts)) {
+        fprintf(stderr, "cannot replay\n");
+        s_failed = 1;
+        return 0;
+    }
+    s_ctx.config->filter.coalesce = coalesce;
+    t503_loop(&s_ctx);
+    t503_exit(&s_ctx);
+    return s_capture.n_events;
+}
+
+/* Values of a key in the order they were written */
+static size_t t503_test_key_values(size_t n_events, uint16_t code, int32_t *values, size_t max_values) {
+    size_t n_values = 0;
+    for (size_t i = 0; i < n_events && n_values < max_values; i++) {
+        if (s_events[i].type == EV_KEY && s_events[i].code == code) values[n_values++] = s_events[i].value;
+    }
+    return n_values;
+}
+
+/* A tap and a hover shorter than a pass of the event loop are not merged away */
+static void t503_test_tap_coalesced(void) {
+    static const struct t503_mock_report reports[] = {
+        T503_TEST_PEN(1000, 1000, 0),
+        T503_TEST_PEN(1001, 1000, 0),
+        T503_TEST_PEN(1002, 1000, 400),
+        T503_TEST_PEN(1003, 1000, 0),
+        T503_TEST_PEN(1004, 1000, 0),
+        T503_TEST_PEN_LEAVE,
+        T503_TEST_PEN(2000, 2000, 0),
+        T503_TEST_PEN_LEAVE,
+    };
+    int32_t values[8];
+
+    for (int coalesce = 0; coalesce <= 1; coalesce++) {
+        size_t n_events = t503_test_replay(reports, T503_COUNT_OF(reports), coalesce);
+
+        size_t n_values = t503_test_key_values(n_events, BTN_TOUCH, values, T503_COUNT_OF(values));
+        /* The first frame writes the tip up as well */
+        T503_CHECK(n_values == 3 && values[0] == 0 && values[1] == 1 && values[2] == 0);
+        n_values = t503_test_key_values(n_events, BTN_TOOL_PEN, values, T503_COUNT_OF(values));
+        T503_CHECK(n_values == 4 && values[0] == 1 && values[1] == 0 && values[2] == 1 && values[3] == 0);
+    }
+}
+
+/* Reports recorded from two tablets go back to a device each, the pen leaving one does not lift the other */
+static void t503_test_two_devices(void) {
+    char path[] = "/tmp/T503_replay_test.XXXXXX";
+    static const uint8_t pen_down[8] = { 0x05, 0xc1, 0xe8, 0x03, 0xe8, 0x03, 0x90, 0x01 };
+    static const uint8_t pen_leave[8] = { 0x05, 0x00 };
+    struct t503_replay replay;
+
+    int fd = mkstemp(path);
+    T503_CHECK(fd != -1);
+    if (fd == -1) return;
+    close(fd);
+    unlink(path);
+
+    static char buffer[T503_RECORD_BUFFER_SIZE];
+    FILE *file = t503_record_open(path, buffer, sizeof(buffer));
+    T503_CHECK(file);
+    if (!file) return;
+    t503_record_write(file, 0, 0, pen_down, sizeof(pen_down), 1000);
+    t503_record_write(file, 1, 0, pen_leave, sizeof(pen_leave), 2000);
+    t503_record_write(file, 0, 0, pen_down, sizeof(pen_down), 3000);
+    t503_record_close(file);
+
+    int retn = t503_replay_open(&replay, path);
+    unlink(path);
+    T503_CHECK(!retn);
+    if (retn) return;
+    T503_CHECK(replay.n_reports == 3 && replay.reports[1].device == 1);
+
+    t503_test_replay(replay.reports, replay.n_reports, 0);
+    T503_CHECK(s_ctx.n_devices == 2);
+    T503_CHECK(s_ctx.devices[0].pen.written[T503_PEN_TOUCH] == 1);
+    T503_CHECK(s_ctx.devices[1].arena.frame.n_writes == 1);
+    t503_replay_close(&replay);
+}
+
+/* A record longer than a report or on an unknown endpoint makes the whole capture rejected */
+static void t503_test_bad_record(void) {
+    static const uint8_t pen_down[8] = { 0x05, 0xc1, 0xe8, 0x03, 0xe8, 0x03, 0x90, 0x01 };
+    static const struct t503_mock_report bad[] = {
+        { .length = T503_IO_BUFFER_SIZE + 1, .data = { 0x05 } },
+        { .endpoint = T503_N_ENDPOINTS, .length = 8, .data = { 0x05 } },
+    };
+    static char buffer[T503_RECORD_BUFFER_SIZE];
+    struct t503_replay replay;
+
+    for (size_t i = 0; i < T503_COUNT_OF(bad); i++) {
+        char path[] = "/tmp/T503_replay_test.XXXXXX";
+        int fd = mkstemp(path);
+        T503_CHECK(fd != -1);
+        if (fd == -1) return;
+        close(fd);
+        unlink(path);
+
+        FILE *file = t503_record_open(path, buffer, sizeof(buffer));
+        T503_CHECK(file);
+        if (!file) return;
+        t503_record_write(file, 0, 0, pen_down, sizeof(pen_down), 1000);
+        /* The writer clamps what it is given, the bad record is written as it is */
+        fwrite(&bad[i], sizeof(bad[i]), 1, file);
+        t503_record_close(file);
+
+        errno = 0;
+        int retn = t503_replay_open(&replay, path);
+        unlink(path);
+        T503_CHECK(retn == -1 && errno == EINVAL);
+        if (!retn) t503_replay_close(&replay);
+    }
+}
+
+/* The hidraw transport reads one report per read(), FIFOs given by path stand in for the nodes */
+static void t503_test_hidraw(void) {
+    static const struct t503_mock_report reports[] = {
+        T503_TEST_PEN(1000, 1000, 0),
+        T503_TEST_PEN(1000, 1000, 400),
+        T503_TEST_PEN(1010, 1000, 0),
+        T503_TEST_PEN_LEAVE,
+    };
+    char dir[] = "/tmp/T503_hidraw_test.XXXXXX";
+    char paths[T503_N_ENDPOINTS][64];
+    int fds[T503_N_ENDPOINTS];
+    int32_t values[8];
+    size_t i;
+
+    T503_CHECK(mkdtemp(dir));
+    for (i = 0; i < T503_N_ENDPOINTS; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/hidraw%zu", dir, i);
+        T503_CHECK(!mkfifo(paths[i], 0600));
+        /* Read-write, so that neither end waits for the other to be opened */
+        fds[i] = open(paths[i], O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        T503_CHECK(fds[i] != -1);
+    }
+
+    struct t503_options opts = {
+        .transport = T503_TRANSPORT_HIDRAW,
+        .sink = T503_SINK_CAPTURE,
+        .hidraw_paths = { paths[0], paths[1] },
+        .capture = &s_capture,
+    };
+    s_capture = (struct t503_capture_sink){ .events = s_events, .capacity = T503_TEST_MAX_EVENTS };
+    int retn = t503_init(&s_ctx, &opts);
+    T503_CHECK(!retn);
+    if (!retn) {
+        s_ctx.config->filter.coalesce = 0;
+        /* A FIFO would hand several reports to one read, each is handled before the next is written */
+        for (i = 0; i < T503_COUNT_OF(reports); i++) {
+            T503_CHECK(write(fds[0], reports[i].data, reports[i].length) == reports[i].length);
+            t503_alloc_guard_arm();
+            T503_CHECK(t503_reactor_run_once(&s_ctx.reactor, 1000) == 1);
+            t503_alloc_guard_disarm();
+        }
+    }
+    /* The end of file of a node stops the loop */
+    for (i = 0; i < T503_N_ENDPOINTS; i++) {
+        if (fds[i] != -1) close(fds[i]);
+    }
+    if (!retn) {
+        t503_loop(&s_ctx);
+        T503_CHECK(s_ctx.reactor.should_exit);
+        t503_exit(&s_ctx);
+
+        size_t n_values = t503_test_key_values(s_capture.n_events, BTN_TOUCH, values, T503_COUNT_OF(values));
+        T503_CHECK(n_values == 3 && values[0] == 0 && values[1] == 1 && values[2] == 0);
+        n_values = t503_test_key_values(s_capture.n_events, BTN_TOOL_PEN, values, T503_COUNT_OF(values));
+        T503_CHECK(n_values == 2 && values[0] == 1 && values[1] == 0);
+    }
+    for (i = 0; i < T503_N_ENDPOINTS; i++) unlink(paths[i]);
+    rmdir(dir);
+}
+
+int main(void) {
+    t503_test_tap_coalesced();
+    t503_test_two_devices();
+    t503_test_bad_record();
+    t503_test_hidraw();
+    /* Only counts with T503_ALLOC_GUARD, the event loop of every replay above must not allocate */
+    T503_CHECK(!t503_alloc_guard_report());
+    return s_failed;
+}